@@ -65,11 +65,10 @@ void* threadFunc(void* arg) {
   //info("Thread %d calculating offsets", tid);
   long lo = offset(tid, tid, NN);
   long n = offset(tid, tid+1, NN) - lo;
-  Cell<long>** D = new Cell<long>*[n]; //malloc(n * sizeof(long));
+  CellArray<long>* D = memory->array<long>(n); // private to this thread
   for (long i = 0; i < n; i++) {
     //info("Thread %d initializating D[%ld]", tid, i);
-    D[i] = memory->cell<long>(std::to_string(tid) + ":D[" + std::to_string(i) + "]");
-    D[i]->write(tid, lo+i);
+    D->write(tid, i, lo+i);
   }
 
   //info("Thread %d Initializing table", tid);
@@ -88,7 +87,7 @@ void* threadFunc(void* arg) {
     //info("Thread %d: round %d with %ld items left", tid, r, n);
 
     for (long i = 0; i < n; i++) {
-      long x = D[i]->read(tid);
+      long x = D->read(tid, i);
       //printf("Trying %ld at %ld\n", x, constrain(hashl(x) + r));
       option* elem = T + constrain(tid, hashl(x) + r);
       elem->winner->write(tid, tid);
@@ -108,19 +107,19 @@ void* threadFunc(void* arg) {
 
     long j = 0;
     for (long i = 0; i < n; i++) {
-      long x = D[i]->read(tid);
+      long x = D->read(tid, i);
       option* elem = T + constrain(tid, hashl(x) + r);
       if (elem->winner->read(tid) == tid && elem->empty->read(tid)) {
         elem->empty->write(tid, false);
         elem->value->write(tid, x);
       }
       else {
-        D[j]->write(tid, x);
+        D->write(tid, j, x);
         j++;
       }
       // if (T[constrain(tid, hashl(x) + r)].value->read(tid) != x) {
       //   //printf("Saving %ld for next round\n", x);
-      //   D[j]->write(tid, x);
+      //   D->write(tid, j, x);
       //   j++;
       // }
     }
@@ -134,8 +133,6 @@ void* threadFunc(void* arg) {
 
   }
 
-  delete[] D;
-
   memory->barrier(tid);
   return NULL;
 }
@@ -143,9 +140,10 @@ void* threadFunc(void* arg) {
 int main(int argc, char** argv) {
   int PP = argc > 1 ? atoi(argv[1]) : 4;         // number of concurrent threads
   int NN = argc > 2 ? atol(argv[2]) : 100000000; // number of elements to insert
+  bool mesi = argc > 3 && std::string(argv[3]) == "mesi"; // protocol to model, dcwsoli by default
   int MM = 2 * NN; // size of hash table
 
-  memory = new Memory(PP);
+  memory = mesi ? new Memory(PP, MESI()) : new Memory(PP);
   P = memory->cell<int>("P"); P->write(0, PP);
   N = memory->cell<long>("N"); N->write(0, NN);
   M = memory->cell<long>("M"); M->write(0, MM);
@@ -153,15 +151,18 @@ int main(int argc, char** argv) {
   again = memory->cell<bool>("again"); again->write(0, true);
   R = memory->cell<int>("R"); R->write(0, 0);
   T = new option[MM]; //malloc(M * sizeof(option));
+  Cell<bool>* empties = memory->cells<bool>(MM);
+  Cell<long>* values = memory->cells<long>(MM);
+  Cell<int>* winners = memory->cells<int>(MM);
   for (long i = 0; i < MM; i++) {
     // if (i == 1) {
     //   T[i].empty = memory->cell<bool>("T[" + std::to_string(i) + "].empty");
     //   T[i].value = memory->cell<long>("T[" + std::to_string(i) + "].value");
     //   T[i].winner = memory->cell<int>("T[" + std::to_string(i) + "].winner");
     // } else {
-      T[i].empty = memory->cell<bool>("T[" + std::to_string(i) + "].empty");
-      T[i].value = memory->cell<long>("T[" + std::to_string(i) + "].value");
-      T[i].winner = memory->cell<int>("T[" + std::to_string(i) + "].winner");
+      T[i].empty = empties + i;
+      T[i].value = values + i;
+      T[i].winner = winners + i;
     // }
   }
 
@@ -183,6 +184,7 @@ int main(int argc, char** argv) {
   for (int t = 1; t < PP; t++) pthread_join(threads[t], NULL);
 
   //info("Joined threads");
+  memory->dump_stats();
 
   // for (long i = 0; i < MM; i++) {
   //   if (T[i].empty->read(0)) printf("_ ");
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <cmath>
+#include <vector>
 #include "utils.hpp"
 #include "../ssim/pccc.hpp"
 
@@ -19,19 +20,37 @@ Memory* memory;
 
 Cell<int>* P;
 Cell<long>* N;
-Cell<bool>** isPrime;
+// Protocol granularity of isPrime, in bytes. Threads only ever write lines
+// they own in the current phase (see markPrimes), so flags can share lines
+// without their writes racing.
+#ifndef ISPRIME_LINE
+#define ISPRIME_LINE 64
+#endif
+
+typedef CellArray<bool, ISPRIME_LINE> Flags;
+const long PER_LINE = Flags::PER_LINE;
+
+Flags* isPrime;
 Cell<long>* offset;
 Cell<long>* n;
 
 barrier B;
 
+// the line-aligned part of [lo, hi) that thread tid owns
+void ownedRange(int tid, long PP, long lo, long hi, long* mylo, long* myhi) {
+  long firstLine = lo / PER_LINE;
+  long lines = (hi + PER_LINE - 1) / PER_LINE - firstLine;
+  long chunk = (lines + PP - 1) / PP;
+  *mylo = max(lo, (firstLine + min(lines, tid * chunk)) * PER_LINE);
+  *myhi = min(hi, (firstLine + min(lines, (tid + 1) * chunk)) * PER_LINE);
+}
+
 void initializeFlags(int tid) {
   long NN = N->read(tid);
   long PP = P->read(tid);
-  long chunk = max(1, NN / PP);
-  long lo = min(NN, tid * chunk);
-  long hi = min(NN, lo + chunk);
-  for (long i = lo; i < hi; i++) isPrime[i]->write(tid, true);
+  long lo, hi;
+  ownedRange(tid, PP, 0, NN, &lo, &hi);
+  for (long i = lo; i < hi; i++) isPrime->write(tid, i, true);
   memory->barrier(tid);
   synchronize(&B, tid);
 }
@@ -42,74 +61,47 @@ void* markPrimes(void* arg) {
   initializeFlags(tid);
 
   while (n->read(tid) < N->read(tid)) {
-    
-    /* This section is attempting to statically schedule a nested
-     * parallel-for loop of the form
-     *
-     *   pfor {k | offset <= k < n}
-     *     pfor {f | 2 <= f < N / k}
-     *       isPrime[f*k] := false;
-     *
-     * You could imagine there are two cases:
-     *
-     *   if (n - offset) >= P, then each processor can be assigned a unique
-     *   region of values of k. The inner loops will then be entirely
-     *   sequential.
+
+    /* Flags below n are final, so the primes in [offset, n) are known, and
+     * marking their multiples makes the flags below n*n final. Each round
+     * takes two phases, so that no line is read and written in the same one:
      *
-     *   if (n - offset) < P, then multiple processors need to be assigned to
-     *   the same value of k, and the inner loop will also need to be
-     *   parallelized. For each k, this is accomplished by forcing processors p
-     *   where p % (n - offset) == (k - offset) to share the inner loop for k.
-     *   We calculate the number of sharers, and reassign processor ids with
-     *   p' := p / (n - offset). The ids {p'} are then used to statically
-     *   partition the inner loop.
+     *   1. every thread reads the primes k in [offset, n) with k*k < N (the
+     *      larger ones have no composite multiples left to mark).
      *
-     * TODO: there appears to be an off-by-one error somewhere. For example,
-     * running `primes 8 100` omits the prime 97.
+     *   2. each thread marks the multiples of all of them, but only within
+     *      its own line-aligned slice of [n, N). Lines are never written by
+     *      two threads in one phase, so no write loses a race.
      */
 
     long nn = n->read(tid);
     long ooffset = offset->read(tid);
+    long NN = N->read(tid);
     long PP = P->read(tid);
-    
+
     info("Hello from %d with offset=%ld and n=%ld", tid, ooffset, nn);
 
-    long m = nn - ooffset;
-    long chunk = max(1, m / PP);
-
-    long lo = (tid * chunk) % m;
-    long hi = min(m, lo + chunk);
-
-    // figure out how many processors all have the same lo,hi
-    long sharers = PP / m + (tid % m < PP % m ? 1 : 0);
-
-    /*printf("%d: %ld sharers in region [%ld,%ld)\n",
-           tid, sharers, offset+lo, offset+hi); */
-    for (long k = ooffset + lo; k < ooffset + hi; k++) {
-      if (isPrime[k]->read(tid)) {
-        info("Thread %d considering prime %ld", tid, k);
-        long fhi = (N->read(tid) + k - 1) / k - 2; // double check this
-        long sid = tid / m; // sharer id
-        
-        long fchunk = max(1, fhi / sharers);
-        long myflo = min(fhi, sid * fchunk);
-        long myfhi = min(fhi, myflo + fchunk);
-        info("%d(%ld): setting region [%ldk,%ldk) for k=%ld\n",
-               tid, sid, myflo+2, myfhi+2, k);
-        //for (long f = 0; f < fhi; f++) isPrime[(f+2)*k] = false;
-        for (long f = myflo; f < myfhi; f++) {
-          if ((f+2)*k >= nn) isPrime[(f+2)*k]->write(tid, false);
-        }
-      }
-      else info("Thread %d skipping non-prime %ld", tid, k);
+    std::vector<long> primes;
+    for (long k = ooffset; k < nn && k * k < NN; k++) {
+      if (isPrime->read(tid, k)) primes.push_back(k);
     }
-    
+
+    memory->barrier(tid);
+    synchronize(&B, tid);
+
+    long lo, hi;
+    ownedRange(tid, PP, nn, NN, &lo, &hi);
+    info("Thread %d marking [%ld,%ld) for %lu primes", tid, lo, hi, primes.size());
+    for (long k : primes) {
+      for (long i = max(k * k, (lo + k - 1) / k * k); i < hi; i += k) isPrime->write(tid, i, false);
+    }
+
     memory->barrier(tid);
     synchronize(&B, tid);
-    
+
     if (tid == 0) {
       offset->write(tid, nn);
-      n->write(tid, min(N->read(tid), nn * nn));
+      n->write(tid, min(NN, nn * nn));
     }
 
     memory->barrier(tid);
@@ -131,9 +123,10 @@ void verifyIsPrime(long k) {
 int main(int argc, char** argv) {
   int PP = argc > 1 ? atoi(argv[1]) : 1;         // number of concurrent threads
   long NN = argc > 2 ? atol(argv[2]) : 100000000; // size of array
+  bool mesi = argc > 3 && std::string(argv[3]) == "mesi"; // protocol to model, dcwsoli by default
 
 
-  memory = new Memory(PP);
+  memory = mesi ? new Memory(PP, MESI()) : new Memory(PP);
 
   P = memory->cell<int>("P"); P->write(0, PP);
   N = memory->cell<long>("N"); N->write(0, NN);
@@ -141,11 +134,7 @@ int main(int argc, char** argv) {
   pthread_t threads[PP];
   int thread_ids[PP];
 
-  // stupid hacky fix; make the array a little too big to handle off-by-one error
-  isPrime = new Cell<bool>*[NN+3]; //malloc(N * sizeof(long));
-  for (long i = 0; i < NN+3; i++) {
-    isPrime[i] = memory->cell<bool>("isPrime[" + std::to_string(i) + "]");
-  }
+  isPrime = memory->array<bool, ISPRIME_LINE>(NN);
   offset = memory->cell<long>("offset"); offset->write(0, 2);
   n = memory->cell<long>("n"); n->write(0, 4);
 
@@ -165,13 +154,13 @@ int main(int argc, char** argv) {
   // printf("Cleanup...\n");
   for (int t = 1; t < PP; t++) pthread_join(threads[t], NULL);
   info("Joined threads");
+  memory->dump_stats();
 
   for (long k = 2; k < NN; k++) {
-    if (isPrime[k]->read(0)) {
+    if (isPrime->read(0, k)) {
       verifyIsPrime(k);
     }
   }
-  delete[] isPrime;
   delete memory;
   // printf("Done.\n");
 
@@ -1,89 +1,298 @@
 #include <pthread.h>
-#include <unordered_set>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "utils.h"
 
 #ifndef _SSIM_PCCC_H_
 #define _SSIM_PCCC_H_
 
+class CellBase;
 template <class T> class Cell; // forward declaration
+template <class T, int LINE_BYTES = 64> class CellArray;
+enum class PState : uint8_t;
+const char* PStateName(PState s);
 
 /* ========================================================================= *
- * ============================ Global Memory ============================== *
+ * ============================== Statistics =============================== *
  * ========================================================================= */
 
-class Entry {
-public:
-  virtual bool barrier(int id) = 0;
+enum class Op : uint8_t {
+  Read,
+  Write,
+  Barrier
+};
+
+const int NUM_OPS = 3;
+const int NUM_PSTATES = 7;
+
+const char* OpName(Op o) {
+  switch(o) {
+    case Op::Read: return "Read";
+    case Op::Write: return "Write";
+    case Op::Barrier: return "Barrier";
+  }
+  return "OpName Error";
+}
+
+// Per-processor event counts. Only processor `id` updates counters[id], and
+// each one gets its own cache lines, so counting needs no synchronization.
+struct Counters {
+  uint64_t events[NUM_OPS][NUM_PSTATES]; // by operation and state before it
+  uint64_t messages; // control messages to and from the directory
+  uint64_t transfers; // messages carrying data
+  char pad[64 - (sizeof(uint64_t) * (NUM_OPS * NUM_PSTATES + 2)) % 64];
+};
+
+/* ========================================================================= *
+ * =============================== Protocols =============================== *
+ * ========================================================================= */
+
+// Protocol policies. A Memory is built for one of them (e.g. `new Memory(P,
+// MESI())`), and its cells then run that protocol's transitions, which are
+// the specializations of CellBase::read_as, write_as and barrier_as. Both
+// protocols use the same states and counters, so their stats compare 1:1.
+
+// the phase-concurrent protocol
+struct DCWSOLI {
+  static const char* name() { return "DCWSOLI"; }
+  static const bool self_invalidates = true; // does work at barriers
 };
 
+// baseline MESI with a full-map directory, for comparison. Uses the
+// Dirty/Clean/Shared/Invalid states as M/E/S/I, and DState Dirty/Clean/Valid
+// for a directory entry with a modified/exclusive owner or with sharers.
+struct MESI {
+  static const char* name() { return "MESI"; }
+  static const bool self_invalidates = false;
+};
+
+struct ProtocolOps {
+  const char* name;
+  bool self_invalidates;
+  void (CellBase::*read)(int);
+  bool (CellBase::*write)(int);
+  bool (CellBase::*barrier)(int);
+};
+
+// Turns event counts into estimated cycles: every operation costs `hit`,
+// plus the latency of the messages and data transfers it causes.
+struct CostModel {
+  uint64_t hit;
+  uint64_t message;
+  uint64_t transfer;
+
+  CostModel(uint64_t h = 1, uint64_t m = 20, uint64_t t = 40) : hit(h), message(m), transfer(t) {}
+};
+
+/* ========================================================================= *
+ * ============================ Global Memory ============================== *
+ * ========================================================================= */
+
 class Memory {
 
 private:
 
-  std::vector<std::unordered_set<Entry*>> l1caches;
+  // Per-processor states are stored apart from the cells, in chunks of
+  // CHUNK_CELLS cells. Within a chunk, all of processor p's states are
+  // contiguous (one byte each), followed by the same layout of `cached` flags.
+  // Chunks are calloc'd when first needed, so pages a processor never touches
+  // are never backed.
+  static const int CHUNK_BITS = 16;
+  static const uint64_t CHUNK_CELLS = 1ul << CHUNK_BITS;
+  static const uint64_t MAX_CHUNKS = 1ul << (32 - CHUNK_BITS);
+
+  // Cells don't have their own locks; they are striped over these.
+  static const uint32_t NUM_STRIPES = 4096;
+
+  struct Stripe {
+    pthread_mutex_t lock;
+    char pad[64 - sizeof(pthread_mutex_t) % 64]; // one stripe per cache line
+  };
+
+  // cells each processor's barriers visit, i.e. those with their cached flag
+  // set to LISTED
+  std::vector<std::vector<CellBase*>> l1caches;
+
+  // Cells a processor holds Clean need nothing from its barriers, so they are
+  // parked off its list. Whoever moves one out of Clean, under the cell lock,
+  // hands it back here, and the owner's next barrier relists it.
+  struct Handoff {
+    pthread_mutex_t lock;
+    std::vector<CellBase*> cells;
+  };
+  std::vector<Handoff> handoffs;
+
+  Counters* counters;
+
+  pthread_mutex_t lock; // guards allocation and names, never taken by accesses
+  std::atomic<uint64_t> num_cells;
+  std::atomic<PState*>* chunks;
+  Stripe* stripes;
+  std::unordered_map<uint32_t, std::string> names; // only cells that were given one
+  std::vector<std::shared_ptr<void>> blocks; // cell arrays, freed along with the memory
+
+  // reserve n consecutive cell indices, and make sure their states exist
+  uint32_t allocate(uint64_t n) {
+    uint64_t first = num_cells.fetch_add(n);
+    if (first + n > MAX_CHUNKS * CHUNK_CELLS) panic("ssim memory is full (%lu cells)", first + n);
+    for (uint64_t c = first >> CHUNK_BITS; n > 0 && c <= (first + n - 1) >> CHUNK_BITS; c++) {
+      if (chunks[c].load() != NULL) continue;
+      pthread_mutex_lock(&lock);
+      if (chunks[c].load() == NULL) {
+        PState* chunk = (PState*) calloc(2 * num_procs, CHUNK_CELLS);
+        if (chunk == NULL) panic("out of memory allocating ssim states for %lu cells", first + n);
+        chunks[c].store(chunk);
+      }
+      pthread_mutex_unlock(&lock);
+    }
+    return first;
+  }
 
-  pthread_mutex_t lock;
-  std::unordered_set<Entry*> directory;
-  std::unordered_set<Entry*> cells;
+  template <class C>
+  C* make(uint64_t n, const std::string& name, bool dolog) {
+    C* xs = new C[n];
+    uint32_t first = allocate(n);
+    for (uint64_t i = 0; i < n; i++) xs[i].init(this, first + i, dolog);
+
+    pthread_mutex_lock(&lock);
+    blocks.push_back(std::shared_ptr<void>(xs, [](void* p) { delete[] (C*) p; }));
+    if (!name.empty()) names[first] = name;
+    pthread_mutex_unlock(&lock);
+    return xs;
+  }
 
 public:
 
   int num_procs;
+  CostModel costs;
+  ProtocolOps protocol;
 
-  Memory(int P) {
-    pthread_mutex_init(&lock, NULL);
-    num_procs = P;
-    for (int p = 0; p < P; p++) {
-      l1caches.push_back(std::unordered_set<Entry*>());
-    }
+  Memory(int P, CostModel c = CostModel());
+
+  template <class Protocol>
+  Memory(int P, Protocol, CostModel c = CostModel());
+
+  ~Memory() {
+    for (uint64_t c = 0; c < MAX_CHUNKS; c++) free(chunks[c].load());
+    delete[] chunks;
+    delete[] stripes;
+    free(counters);
   }
 
+  // names are optional, and only used for logging
   template <class T>
-  Cell<T>* cell(std::string name) {
-    pthread_mutex_lock(&lock);
+  Cell<T>* cell(const std::string& name = "") {
+    return make<Cell<T>>(1, name, false);
+  }
+
+  template <class T>
+  Cell<T>* logged_cell(const std::string& name) {
+    return make<Cell<T>>(1, name, true);
+  }
 
-    auto x = new Cell<T>(this, name, false);
-    cells.insert(x);
+  // n unnamed cells, contiguous in the returned array
+  template <class T>
+  Cell<T>* cells(uint64_t n) {
+    return make<Cell<T>>(n, "", false);
+  }
 
+  // n values sharing protocol state per line, see CellArray
+  template <class T, int LINE_BYTES = 64>
+  CellArray<T, LINE_BYTES>* array(uint64_t n, const std::string& name = "") {
+    typedef CellArray<T, LINE_BYTES> A;
+    CellBase* lines = make<CellBase>((n + A::PER_LINE - 1) / A::PER_LINE, name, false);
+    A* a = new A(this, n, lines);
+
+    pthread_mutex_lock(&lock);
+    blocks.push_back(std::shared_ptr<void>(a, [](void* p) { delete (A*) p; }));
     pthread_mutex_unlock(&lock);
-    return x;
+    return a;
   }
 
-  template <class T>
-  Cell<T>* logged_cell(std::string name) {
+  std::string name(uint32_t index) {
     pthread_mutex_lock(&lock);
+    auto itr = names.find(index);
+    std::string result = (itr != names.end()) ? itr->second : "#" + std::to_string(index);
+    pthread_mutex_unlock(&lock);
+    return result;
+  }
 
-    auto x = new Cell<T>(this, name, true);
-    cells.insert(x);
+  PState& pstate(int id, uint32_t index) {
+    PState* chunk = chunks[index >> CHUNK_BITS].load(std::memory_order_acquire);
+    return chunk[(uint64_t)id * CHUNK_CELLS + (index & (CHUNK_CELLS - 1))];
+  }
 
-    pthread_mutex_unlock(&lock);
-    return x;
+  // values of a cached flag
+  static const uint8_t UNCACHED = 0;
+  static const uint8_t LISTED = 1; // on id's barrier list
+  static const uint8_t PARKED = 2; // held Clean, off the list
+
+  uint8_t& cached(int id, uint32_t index) {
+    PState* chunk = chunks[index >> CHUNK_BITS].load(std::memory_order_acquire);
+    return ((uint8_t*) chunk)[(uint64_t)(num_procs + id) * CHUNK_CELLS + (index & (CHUNK_CELLS - 1))];
   }
 
-  // make sure e is in id's l1 cache
-  void touch(int id, Entry* e) {
-    l1caches[id].insert(e);
+  // For reading id's own state without the cell lock, while other
+  // processors may be storing to it with the lock held (see store_pstate).
+  PState load_pstate(int id, uint32_t index) {
+    return (PState) __atomic_load_n((uint8_t*) &pstate(id, index), __ATOMIC_RELAXED);
   }
 
-  // when processor `id` issues a barrier, we need to tell every element of its
-  // cache to handle barrier transitions.
-  void barrier(int id) {
-    auto l1cache = l1caches[id];
-    for (auto itr = l1cache.begin(); itr != l1cache.end(); ) {
-      if ((*itr)->barrier(id)) itr = l1caches[id].erase(itr);
-      else ++itr;
+  // for setting another processor's state, with the cell lock held
+  void store_pstate(int id, uint32_t index, PState s) {
+    __atomic_store_n((uint8_t*) &pstate(id, index), (uint8_t) s, __ATOMIC_RELAXED);
+  }
+
+  void lock_cell(uint32_t index) {
+    pthread_mutex_lock(&stripes[index % NUM_STRIPES].lock);
+  }
+
+  void unlock_cell(uint32_t index) {
+    pthread_mutex_unlock(&stripes[index % NUM_STRIPES].lock);
+  }
+
+  // make sure e is in id's l1 cache, with e's lock held
+  void touch(int id, CellBase* e);
+
+  // relist a cell p parked, with the cell lock held and p's state just
+  // moved out of Clean
+  void unpark(int p, CellBase* e);
+
+  // processor `id` did `op` on a cell it held in state `s`
+  void record(int id, Op op, PState s, uint64_t msgs, uint64_t xfers) {
+    Counters& c = counters[id];
+    c.events[(int) op][(int) s]++;
+    c.messages += msgs;
+    c.transfers += xfers;
+  }
+
+  uint64_t estimated_cycles(int id) {
+    Counters& c = counters[id];
+    uint64_t ops = 0;
+    for (int o = 0; o < NUM_OPS; o++) {
+      for (int s = 0; s < NUM_PSTATES; s++) ops += c.events[o][s];
     }
+    return ops * costs.hit + c.messages * costs.message + c.transfers * costs.transfer;
   }
 
+  void dump_stats(FILE* out = stdout);
+
+  void barrier(int id);
+
 };
 
 /* ========================================================================= *
  * ======================== Individual Memory Cells ======================== *
  * ========================================================================= */
 
-enum class DState {
+enum class DState : uint8_t {
   Dirty,
   Clean,
   Winner,
@@ -102,14 +311,15 @@ const char* DStateName(DState s) {
   return "DStateName Error";
 }
 
-enum class PState {
+// Invalid is 0 so that freshly allocated (zeroed) states start out invalid
+enum class PState : uint8_t {
+  Invalid = 0,
   Dirty,
   Clean,
   Winner,
   Shared,
   Old,
-  Loser,
-  Invalid
+  Loser
 };
 
 const char* PStateName(PState s) {
@@ -125,131 +335,318 @@ const char* PStateName(PState s) {
   return "PStateName Error";
 }
 
-template <class T>
-class Cell : public Entry {
 
-private:
+// Protocol state of a cell, independent of the type of its value. The
+// per-processor states live in the memory, indexed by `index`.
+class CellBase {
+
+protected:
 
-  std::string name;
-  bool logged; // set to true if you want to see all sorts of info
-  T value;
-  int registered; // if dstate is one of Dirty|Clean|Winner, then this is the id of the owning thread
-  DState dstate;
-  PState* pstates;
-  pthread_mutex_t lock;
   Memory* memory; // the global memory which owns this cell
+  uint32_t index;
+  int16_t registered; // if dstate is one of Dirty|Clean|Winner, then this is the id of the owning thread
+  DState dstate;
+  bool logged; // set to true if you want to see all sorts of info
+
+  PState& pstate(int id) {
+    return memory->pstate(id, index);
+  }
+
+  std::string name() {
+    return memory->name(index);
+  }
 
 public:
 
-  Cell(Memory* m, std::string str, bool dolog) {
-    logged = dolog;
-    name = str;
+  void init(Memory* m, uint32_t idx, bool dolog) {
     memory = m;
+    index = idx;
     registered = -1;
     dstate = DState::Invalid;
-    pstates = new PState[m->num_procs];
-    for (int p = 0; p < m->num_procs; p++) {
-      pstates[p] = PState::Invalid;
-    }
-    pthread_mutex_init(&lock, NULL);
+    logged = dolog;
+  }
+
+  // transitions of the memory's protocol
+  void read_transition(int id) {
+    (this->*(memory->protocol.read))(id);
+  }
+
+  bool write_transition(int id) {
+    return (this->*(memory->protocol.write))(id);
   }
 
-  T read(int id);
-  void write(int id, T v);
-  bool barrier(int id) override;
+  bool barrier(int id) {
+    return (this->*(memory->protocol.barrier))(id);
+  }
+
+  // Read and write transitions run with the cell lock held. Writes return
+  // true if the written value should land. Barriers take the lock themselves
+  // if they need it, and return true if the cell left id's barrier list.
+  template <class Protocol> void read_as(int id);
+  template <class Protocol> bool write_as(int id);
+  template <class Protocol> bool barrier_as(int id);
+
+  friend class Memory;
+  template <class T, int LINE_BYTES> friend class CellArray;
 
 };
 
 template <class T>
-T Cell<T>::read(int id) {
-  assert(0 <= id && id < memory->num_procs);
-  memory->touch(id, this);
+class Cell : public CellBase {
+
+private:
+
+  T value;
+
+public:
 
-  pthread_mutex_lock(&lock);
+  T read(int id) {
+    assert(0 <= id && id < memory->num_procs);
+    memory->lock_cell(index);
+    memory->touch(id, this);
+    T result = value;
+    read_transition(id);
+    memory->unlock_cell(index);
+    return result;
+  }
+
+  void write(int id, T v) {
+    assert(0 <= id && id < memory->num_procs);
+    memory->lock_cell(index);
+    memory->touch(id, this);
+    if (write_transition(id)) value = v;
+    memory->unlock_cell(index);
+  }
 
-  if (logged) info("Thread %d reading Cell(%s): [%s] [%s %d]", id, name.c_str(), PStateName(pstates[id]), DStateName(dstate), registered);
+};
+
+// An array of values whose protocol state is kept per line of LINE_BYTES
+// bytes, like a hardware cache would. All elements of a line share its
+// states, so concurrent writes to different elements of a line race exactly
+// like writes to the same cell (i.e., the losers' values are dropped).
+template <class T, int LINE_BYTES>
+class CellArray {
+
+public:
+
+  static const uint64_t PER_LINE = (sizeof(T) < LINE_BYTES) ? LINE_BYTES / sizeof(T) : 1;
+
+private:
+
+  Memory* memory;
+  uint64_t n;
+  T* values;
+  CellBase* lines;
+
+public:
 
-  T result = value;
+  CellArray(Memory* m, uint64_t num, CellBase* ls) : memory(m), n(num), values(new T[num]), lines(ls) {}
 
-  switch (pstates[id]) {
+  ~CellArray() {
+    delete[] values;
+  }
+
+  uint64_t size() {
+    return n;
+  }
+
+  T read(int id, uint64_t i) {
+    assert(0 <= id && id < memory->num_procs);
+    assert(i < n);
+    CellBase* line = &lines[i / PER_LINE];
+    memory->lock_cell(line->index);
+    memory->touch(id, line);
+    T result = values[i];
+    line->read_transition(id);
+    memory->unlock_cell(line->index);
+    return result;
+  }
+
+  void write(int id, uint64_t i, T v) {
+    assert(0 <= id && id < memory->num_procs);
+    assert(i < n);
+    CellBase* line = &lines[i / PER_LINE];
+    memory->lock_cell(line->index);
+    memory->touch(id, line);
+    if (line->write_transition(id)) values[i] = v;
+    memory->unlock_cell(line->index);
+  }
+
+};
+
+void Memory::touch(int id, CellBase* e) {
+  uint8_t& c = cached(id, e->index);
+  if (c == UNCACHED) {
+    c = LISTED;
+    l1caches[id].push_back(e);
+  }
+}
+
+void Memory::unpark(int p, CellBase* e) {
+  uint8_t& c = cached(p, e->index);
+  if (c != PARKED) return;
+  c = LISTED;
+  Handoff& h = handoffs[p];
+  pthread_mutex_lock(&h.lock);
+  h.cells.push_back(e);
+  pthread_mutex_unlock(&h.lock);
+}
+
+template <> void CellBase::read_as<DCWSOLI>(int id);
+template <> bool CellBase::write_as<DCWSOLI>(int id);
+template <> bool CellBase::barrier_as<DCWSOLI>(int id);
+template <> void CellBase::read_as<MESI>(int id);
+template <> bool CellBase::write_as<MESI>(int id);
+template <> bool CellBase::barrier_as<MESI>(int id);
+
+template <class Protocol>
+Memory::Memory(int P, Protocol, CostModel c) : costs(c) {
+  protocol.name = Protocol::name();
+  protocol.self_invalidates = Protocol::self_invalidates;
+  protocol.read = &CellBase::read_as<Protocol>;
+  protocol.write = &CellBase::write_as<Protocol>;
+  protocol.barrier = &CellBase::barrier_as<Protocol>;
+
+  assert_msg(0 < P && P <= INT16_MAX, "unsupported number of processors %d", P);
+  pthread_mutex_init(&lock, NULL);
+  num_procs = P;
+  for (int p = 0; p < P; p++) {
+    l1caches.push_back(std::vector<CellBase*>());
+  }
+  handoffs.resize(P);
+  for (int p = 0; p < P; p++) pthread_mutex_init(&handoffs[p].lock, NULL);
+  num_cells = 0;
+  chunks = new std::atomic<PState*>[MAX_CHUNKS];
+  for (uint64_t c = 0; c < MAX_CHUNKS; c++) chunks[c] = NULL;
+  stripes = new Stripe[NUM_STRIPES];
+  for (uint32_t s = 0; s < NUM_STRIPES; s++) pthread_mutex_init(&stripes[s].lock, NULL);
+  if (posix_memalign((void**) &counters, 64, P * sizeof(Counters)) != 0) panic("out of memory allocating ssim counters");
+  memset(counters, 0, P * sizeof(Counters));
+}
+
+Memory::Memory(int P, CostModel c) : Memory(P, DCWSOLI(), c) {}
+
+// when processor `id` issues a barrier, we need to tell every element of its
+// cache but the parked Clean ones to handle barrier transitions. This is a
+// single pass that compacts the list in place, dropping cells that became
+// invalid or were parked.
+void Memory::barrier(int id) {
+  if (!protocol.self_invalidates) return;
+  std::vector<CellBase*>& l1cache = l1caches[id];
+
+  Handoff& h = handoffs[id];
+  pthread_mutex_lock(&h.lock);
+  l1cache.insert(l1cache.end(), h.cells.begin(), h.cells.end());
+  h.cells.clear();
+  pthread_mutex_unlock(&h.lock);
+
+  size_t kept = 0;
+  for (size_t i = 0; i < l1cache.size(); i++) {
+    CellBase* e = l1cache[i];
+    if (!e->barrier(id)) l1cache[kept++] = e;
+  }
+  l1cache.resize(kept);
+}
+
+/* ========================================================================= *
+ * ========================== DCWSOLI Transitions ========================== *
+ * ========================================================================= */
+
+template <>
+void CellBase::read_as<DCWSOLI>(int id) {
+  if (logged) info("Thread %d reading Cell(%s): [%s] [%s %d]", id, name().c_str(), PStateName(pstate(id)), DStateName(dstate), registered);
+
+  PState from = pstate(id);
+  uint64_t msgs = 0, xfers = 0;
+
+  switch (from) {
     case PState::Dirty:
       break;
     case PState::Clean:
       break;
     case PState::Winner:
-      panic("thread %d attempted to read Cell(%s) while winner.", id, name.c_str());
+      panic("thread %d attempted to read Cell(%s) while winner.", id, name().c_str());
       break;
     case PState::Shared:
       break;
     case PState::Old:
-      pstates[id] = PState::Shared;
+      pstate(id) = PState::Shared;
       break;
     case PState::Loser:
-      //panic("thread %d attempted to read Cell(%s) while loser.", id, name.c_str());
+      //panic("thread %d attempted to read Cell(%s) while loser.", id, name().c_str());
       //break;
     case PState::Invalid:
       switch (dstate) {
         case DState::Dirty:
-          panic("thread %d attempted to acquire Cell(%s) while directory has thread %d registered as dirty.", id, name.c_str(), registered);
+          panic("thread %d attempted to acquire Cell(%s) while directory has thread %d registered as dirty.", id, name().c_str(), registered);
           break;
         case DState::Clean:
-          assert(pstates[registered] == PState::Clean);
-          pstates[registered] = PState::Shared;
-          pstates[id] = PState::Shared;
+          assert(pstate(registered) == PState::Clean);
+          memory->store_pstate(registered, index, PState::Shared);
+          memory->unpark(registered, this);
+          pstate(id) = PState::Shared;
           dstate = DState::Valid;
           registered = -1;
+          msgs = 3; // request, downgrade to owner, ack
+          xfers = 1;
           break;
         case DState::Winner:
-          panic("thread %d attempted to acquire Cell(%s) while directory has thread %d registered as winner.", id, name.c_str(), registered);
+          panic("thread %d attempted to acquire Cell(%s) while directory has thread %d registered as winner.", id, name().c_str(), registered);
           break;
         case DState::Valid:
-          pstates[id] = PState::Shared;
+          pstate(id) = PState::Shared;
+          msgs = 1;
+          xfers = 1;
           break;
         case DState::Invalid:
           //info("thread %d is now registered clean", id);
-          pstates[id] = PState::Clean;
+          pstate(id) = PState::Clean;
           dstate = DState::Clean;
           registered = id;
+          msgs = 1;
+          xfers = 1;
           break;
       }
       break;
   }
 
-  pthread_mutex_unlock(&lock);
-  return result;
+  memory->record(id, Op::Read, from, msgs, xfers);
 }
 
-template <class T>
-void Cell<T>::write(int id, T v) {
-  assert(0 <= id && id < memory->num_procs);
-  memory->touch(id, this);
-  pthread_mutex_lock(&lock);
+// the written value lands unless `id` lost a race
+template <>
+bool CellBase::write_as<DCWSOLI>(int id) {
+  bool lands = false;
+
+  if (logged) info("Thread %d writing Cell(%s): [%s] [%s %d]", id, name().c_str(), PStateName(pstate(id)), DStateName(dstate), registered);
 
-  if (logged) info("Thread %d writing Cell(%s): [%s] [%s %d]", id, name.c_str(), PStateName(pstates[id]), DStateName(dstate), registered);
+  PState from = pstate(id);
+  uint64_t msgs = 0, xfers = 0;
 
-  switch (pstates[id]) {
+  switch (from) {
     case PState::Dirty:
       assert(dstate == DState::Dirty);
       assert(registered == id);
-      value = v;
+      lands = true;
       break;
     case PState::Clean:
       assert(dstate == DState::Clean);
       assert(registered == id);
-      pstates[id] = PState::Dirty;
+      pstate(id) = PState::Dirty;
       dstate = DState::Dirty;
-      value = v;
+      memory->unpark(id, this);
+      lands = true;
       break;
     case PState::Winner:
       assert(dstate == DState::Winner);
       assert(registered == id);
-      value = v;
+      lands = true;
       break;
     case PState::Shared:
-      //panic("thread %d attempted to write Cell(%s) while shared.", id, name.c_str())
+      //panic("thread %d attempted to write Cell(%s) while shared.", id, name().c_str())
       //assert(dstate == DState::Valid);
       //assert(registered == -1);
-      // pstates[id] = PState::Dirty; // FIX
+      // pstate(id) = PState::Dirty; // FIX
       // dstate = DState::Dirty;
       // registered = id;
       // value = v;
@@ -258,29 +655,36 @@ void Cell<T>::write(int id, T v) {
       switch (dstate) {
         case DState::Dirty:
           assert(registered != id);
-          pstates[id] = PState::Loser;
-          pstates[registered] = PState::Winner;
+          pstate(id) = PState::Loser;
+          memory->store_pstate(registered, index, PState::Winner);
           dstate = DState::Winner;
+          msgs = 3; // request, contention notification to the winner, reject
           break;
         case DState::Clean:
           assert(registered != id);
-          pstates[id] = PState::Winner;
-          //pstates[registered] = PState::Loser;
-          pstates[registered] = PState::Invalid; // FIX
+          pstate(id) = PState::Winner;
+          //pstate(registered) = PState::Loser;
+          memory->store_pstate(registered, index, PState::Invalid); // FIX
+          memory->unpark(registered, this);
           dstate = DState::Winner;
           registered = id;
-          value = v;
+          lands = true;
+          msgs = 3; // request, invalidate to the owner, ack
+          xfers = 1;
           break;
         case DState::Winner:
           assert(registered != id);
-          pstates[id] = PState::Loser;
+          pstate(id) = PState::Loser;
+          msgs = 2; // request, reject
           break;
         case DState::Valid:
           assert(registered == -1);
-          pstates[id] = PState::Dirty;
+          pstate(id) = PState::Dirty;
           dstate = DState::Dirty;
           registered = id;
-          value = v;
+          lands = true;
+          msgs = 1;
+          xfers = 1;
           break;
         case DState::Invalid:
           panic("non-inclusivity at a write?");
@@ -289,95 +693,289 @@ void Cell<T>::write(int id, T v) {
       break;
     case PState::Loser:
       // NOTE: It turns out that the directory could be Valid right now
-      // assert_msg(dstate == DState::Winner, "Thread %d failed \"dstate == DState::Winner\" during write to Cell(%s), where dstate == %s", id, name.c_str(), DStateName(dstate));
+      // assert_msg(dstate == DState::Winner, "Thread %d failed \"dstate == DState::Winner\" during write to Cell(%s), where dstate == %s", id, name().c_str(), DStateName(dstate));
       // assert(registered != id);
       break;
     case PState::Invalid:
       switch (dstate) {
         case DState::Dirty:
           assert(registered != id);
-          pstates[id] = PState::Loser;
-          pstates[registered] = PState::Winner;
+          pstate(id) = PState::Loser;
+          memory->store_pstate(registered, index, PState::Winner);
           dstate = DState::Winner;
+          msgs = 3; // request, contention notification to the winner, reject
           break;
         case DState::Clean:
           assert(registered != id);
-          pstates[id] = PState::Winner;
-          //pstates[registered] = PState::Loser;
-          pstates[registered] = PState::Invalid; // FIX
+          pstate(id) = PState::Winner;
+          //pstate(registered) = PState::Loser;
+          memory->store_pstate(registered, index, PState::Invalid); // FIX
+          memory->unpark(registered, this);
           dstate = DState::Winner;
           registered = id;
-          value = v;
+          lands = true;
+          msgs = 3; // request, invalidate to the owner, ack
+          xfers = 1;
           break;
         case DState::Winner:
           assert(registered != id);
-          pstates[id] = PState::Loser;
+          pstate(id) = PState::Loser;
+          msgs = 2; // request, reject
           break;
         case DState::Valid:
           assert(registered == -1);
-          pstates[id] = PState::Dirty;
+          pstate(id) = PState::Dirty;
           dstate = DState::Dirty;
           registered = id;
-          value = v;
+          lands = true;
+          msgs = 1;
+          xfers = 1;
           break;
         case DState::Invalid:
           assert(registered == -1);
-          pstates[id] = PState::Dirty;
+          pstate(id) = PState::Dirty;
           dstate = DState::Dirty;
           registered = id;
-          value = v;
+          lands = true;
+          msgs = 1;
+          xfers = 1;
           break;
       }
       break;
   }
 
-  pthread_mutex_unlock(&lock);
+  memory->record(id, Op::Write, from, msgs, xfers);
+  return lands;
 }
 
-template <class T>
-bool Cell<T>::barrier(int id) {
-  //info("Thread %d barrier on Cell(%s)", id, name.c_str());
+template <>
+bool CellBase::barrier_as<DCWSOLI>(int id) {
+  //info("Thread %d barrier on Cell(%s)", id, name().c_str());
 
   assert(0 <= id && id < memory->num_procs);
 
+  // Other processors only change our state while we are registered in the
+  // directory (Dirty, Clean, Winner). In any other state, the transition only
+  // involves our own state and cached flag, so it doesn't need the cell lock.
+  PState s = memory->load_pstate(id, index);
+  if (!logged && s != PState::Dirty && s != PState::Clean && s != PState::Winner) {
+    pstate(id) = (s == PState::Shared) ? PState::Old : PState::Invalid;
+    memory->record(id, Op::Barrier, s, 0, 0); // silent
+    if (s == PState::Shared) return false;
+    memory->cached(id, index) = Memory::UNCACHED;
+    return true;
+  }
+
   bool result = false;
+  uint64_t xfers = 0;
 
-  pthread_mutex_lock(&lock);
+  memory->lock_cell(index);
 
-  if (logged) info("Thread %d barrier on Cell(%s): [%s] [%s %d]", id, name.c_str(), PStateName(pstates[id]), DStateName(dstate), registered);
+  if (logged) info("Thread %d barrier on Cell(%s): [%s] [%s %d]", id, name().c_str(), PStateName(pstate(id)), DStateName(dstate), registered);
 
-  switch (pstates[id]) {
+  PState from = pstate(id);
+  switch (from) {
     case PState::Dirty:
-      assert_msg(dstate == DState::Dirty && registered == id, "Thread %d failed 'dstate == DState::Dirty && registered == id' during barrier on Cell(%s), where dstate == %s, registered == %d", id, name.c_str(), DStateName(dstate), registered);
-      pstates[id] = PState::Clean;
+      assert_msg(dstate == DState::Dirty && registered == id, "Thread %d failed 'dstate == DState::Dirty && registered == id' during barrier on Cell(%s), where dstate == %s, registered == %d", id, name().c_str(), DStateName(dstate), registered);
+      pstate(id) = PState::Clean;
       dstate = DState::Clean;
+      xfers = 1; // writeback
       break;
     case PState::Clean:
-      assert_msg(dstate == DState::Clean && registered == id, "Thread %d failed 'dstate == DState::Clean && registered == id' during barrier on Cell(%s), where dstate == %s, registered == %d", id, name.c_str(), DStateName(dstate), registered);
+      assert_msg(dstate == DState::Clean && registered == id, "Thread %d failed 'dstate == DState::Clean && registered == id' during barrier on Cell(%s), where dstate == %s, registered == %d", id, name().c_str(), DStateName(dstate), registered);
       assert(registered == id);
       break;
     case PState::Winner:
       assert(dstate == DState::Winner);
       assert(registered == id);
-      pstates[id] = PState::Old;
+      pstate(id) = PState::Old;
       dstate = DState::Valid;
       registered = -1;
+      xfers = 1; // writeback, now visible to everyone
       break;
     case PState::Shared:
       //assert_msg(dstate == DState::Valid, "Thread %d failed \"dstate == DState::Valid\", where dstate == %s", id, DStateName(dstate));
       //assert(registered == -1);
-      pstates[id] = PState::Old;
+      pstate(id) = PState::Old;
       break;
     case PState::Old:
     case PState::Loser:
     case PState::Invalid:
-      pstates[id] = PState::Invalid;
-      result = false;
+      pstate(id) = PState::Invalid;
+      memory->cached(id, index) = Memory::UNCACHED;
+      result = true;
       break;
   }
 
-  pthread_mutex_unlock(&lock);
+  // nothing for our barriers to do until someone moves it out of Clean
+  if (pstate(id) == PState::Clean) {
+    memory->cached(id, index) = Memory::PARKED;
+    result = true;
+  }
+
+  memory->record(id, Op::Barrier, from, 0, xfers);
+  memory->unlock_cell(index);
   return result;
 }
 
+/* ========================================================================= *
+ * ============================ MESI Transitions =========================== *
+ * ========================================================================= */
+
+template <>
+void CellBase::read_as<MESI>(int id) {
+  if (logged) info("Thread %d reading Cell(%s): [%s] [%s %d]", id, name().c_str(), PStateName(pstate(id)), DStateName(dstate), registered);
+
+  PState from = pstate(id);
+  uint64_t msgs = 0, xfers = 0;
+
+  switch (from) {
+    case PState::Dirty:
+    case PState::Clean:
+    case PState::Shared:
+      break;
+    case PState::Invalid:
+      switch (dstate) {
+        case DState::Dirty:
+          assert(registered != id);
+          pstate(registered) = PState::Shared;
+          msgs = 2; // request, forward to the owner
+          xfers = 2; // data to us, writeback to the directory
+          break;
+        case DState::Clean:
+          assert(registered != id);
+          pstate(registered) = PState::Shared;
+          msgs = 3; // request, downgrade to the owner, ack
+          xfers = 1;
+          break;
+        case DState::Valid:
+          msgs = 1;
+          xfers = 1;
+          break;
+        case DState::Invalid:
+          pstate(id) = PState::Clean;
+          dstate = DState::Clean;
+          registered = id;
+          msgs = 1;
+          xfers = 1;
+          break;
+        case DState::Winner:
+          panic("MESI Cell(%s) has a winner", name().c_str());
+          break;
+      }
+      // unless we became the exclusive owner, we now share the line
+      if (pstate(id) == PState::Invalid) {
+        pstate(id) = PState::Shared;
+        dstate = DState::Valid;
+        registered = -1;
+      }
+      break;
+    default:
+      panic("thread %d has MESI Cell(%s) in state %s", id, name().c_str(), PStateName(from));
+      break;
+  }
+
+  memory->record(id, Op::Read, from, msgs, xfers);
+}
+
+// writes always land under MESI
+template <>
+bool CellBase::write_as<MESI>(int id) {
+  if (logged) info("Thread %d writing Cell(%s): [%s] [%s %d]", id, name().c_str(), PStateName(pstate(id)), DStateName(dstate), registered);
+
+  PState from = pstate(id);
+  uint64_t msgs = 0, xfers = 0;
+
+  switch (from) {
+    case PState::Dirty:
+      break;
+    case PState::Clean:
+      // silent E->M
+      break;
+    case PState::Shared:
+    case PState::Invalid:
+      switch (dstate) {
+        case DState::Dirty:
+        case DState::Clean:
+          assert(from == PState::Invalid && registered != id);
+          pstate(registered) = PState::Invalid;
+          msgs = 3; // request, invalidate to the owner, ack
+          xfers = 1;
+          break;
+        case DState::Valid:
+          // invalidate every other sharer, and wait for their acks
+          msgs = 2;
+          for (int p = 0; p < memory->num_procs; p++) {
+            if (p != id && pstate(p) == PState::Shared) {
+              pstate(p) = PState::Invalid;
+              msgs += 2;
+            }
+          }
+          if (from == PState::Invalid) {
+            msgs--; // the grant carries the data
+            xfers = 1;
+          }
+          break;
+        case DState::Invalid:
+          msgs = 1;
+          xfers = 1;
+          break;
+        case DState::Winner:
+          panic("MESI Cell(%s) has a winner", name().c_str());
+          break;
+      }
+      break;
+    default:
+      panic("thread %d has MESI Cell(%s) in state %s", id, name().c_str(), PStateName(from));
+      break;
+  }
+
+  pstate(id) = PState::Dirty;
+  dstate = DState::Dirty;
+  registered = id;
+
+  memory->record(id, Op::Write, from, msgs, xfers);
+  return true;
+}
+
+// MESI keeps caches coherent eagerly, so barriers don't touch them
+template <>
+bool CellBase::barrier_as<MESI>(int) {
+  return false;
+}
+
+void Memory::dump_stats(FILE* out) {
+  Counters total;
+  memset(&total, 0, sizeof(Counters));
+  uint64_t max_cycles = 0;
+
+  fprintf(out, "ssim stats for %s (cost model: hit %lu, message %lu, transfer %lu cycles)\n", protocol.name, costs.hit, costs.message, costs.transfer);
+  for (int p = 0; p < num_procs; p++) {
+    Counters& c = counters[p];
+    uint64_t ops[NUM_OPS] = {0, 0, 0};
+    for (int o = 0; o < NUM_OPS; o++) {
+      for (int s = 0; s < NUM_PSTATES; s++) {
+        ops[o] += c.events[o][s];
+        total.events[o][s] += c.events[o][s];
+      }
+    }
+    total.messages += c.messages;
+    total.transfers += c.transfers;
+    uint64_t cycles = estimated_cycles(p);
+    if (cycles > max_cycles) max_cycles = cycles;
+    fprintf(out, "  proc %d: %lu reads, %lu writes, %lu barrier lines, %lu messages, %lu transfers, ~%lu cycles\n",
+            p, ops[(int) Op::Read], ops[(int) Op::Write], ops[(int) Op::Barrier], c.messages, c.transfers, cycles);
+  }
+
+  for (int o = 0; o < NUM_OPS; o++) {
+    fprintf(out, "  %-8s", OpName((Op) o));
+    for (int s = 0; s < NUM_PSTATES; s++) {
+      fprintf(out, " %s %lu", PStateName((PState) s) + strlen("PState."), total.events[o][s]);
+    }
+    fprintf(out, "\n");
+  }
+  fprintf(out, "  total: %lu messages, %lu transfers, ~%lu cycles on the slowest processor\n",
+          total.messages, total.transfers, max_cycles);
+}
+
 #endif
@@ -1,5 +1,6 @@
 #include <math.h>
 #include <time.h>
+#include "../zsim/misc/hooks/zsim_hooks.h"
 
 inline int atomicAdd(int* loc, int delta) {
   return __sync_add_and_fetch(loc, delta);
@@ -67,6 +68,8 @@ void blink(long ns) {
 }  
 
 void synchronize_before(void (*f)(void), barrier* b, int tid) {
+  // publish this phase's writes before arriving (no-op outside zsim)
+  zsim_phase_barrier();
   int seed = b->seed;
   int s = (fetch(sense(b)) == 0 ? 1 : 0);
   if (atomicAdd(count(b), 1) != b->procs) {
@@ -14,6 +14,7 @@
 #define ZSIM_MAGIC_OP_HEARTBEAT         (1028)
 #define ZSIM_MAGIC_OP_WORK_BEGIN        (1029) //ubik
 #define ZSIM_MAGIC_OP_WORK_END          (1030) //ubik
+#define ZSIM_MAGIC_OP_PHASE_BARRIER     (1034) //DCWSOLI self-downgrade of the caller's private caches
 
 #ifdef __x86_64__
 #define HOOKS_STR  "HOOKS"
@@ -46,4 +47,6 @@ static inline void zsim_heartbeat() {
 static inline void zsim_work_begin() { zsim_magic_op(ZSIM_MAGIC_OP_WORK_BEGIN); }
 static inline void zsim_work_end() { zsim_magic_op(ZSIM_MAGIC_OP_WORK_END); }
 
+static inline void zsim_phase_barrier() { zsim_magic_op(ZSIM_MAGIC_OP_PHASE_BARRIER); }
+
 #endif /*__ZSIM_HOOKS_H__*/
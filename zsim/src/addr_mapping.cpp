@@ -0,0 +1,89 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "addr_mapping.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "bithacks.h"
+#include "config.h"  // for Tokenize
+
+void AddrHash::init(const char* typeStr, uint32_t _bits) {
+    std::string t(typeStr);
+    if (t == "None") type = NONE;
+    else if (t == "XOR") type = XOR;
+    else if (t == "Permutation") type = PERMUTATION;
+    else panic("Invalid address hash %s (None, XOR or Permutation)", typeStr);
+    bits = _bits;
+    mask = (1ul << bits) - 1;
+}
+
+void DRAMAddrMapping::init(const char* mapping, const char* hash, uint32_t lineSize, uint32_t pageSize,
+        uint32_t ranksPerChannel, uint32_t banksPerRank) {
+    // We get line addresses, and for a 64-byte line, there are pageSize/(64/8) lines/page
+    uint32_t colBits = ilog2(pageSize/8*64/lineSize);
+    uint32_t bankBits = ilog2(banksPerRank);
+    uint32_t rankBits = ilog2(ranksPerChannel);
+
+    // Parse config string, has to be some combination of rank, bank, and col separated by semicolons
+    // (row is always MSB bits, since we don't actually know how many bits it is to begin with...)
+    std::vector<std::string> tokens;
+    Tokenize(mapping, tokens, ":");
+    if (tokens.size() != 3) panic("Invalid addrMapping %s, need all row/col/rank tokens separated by colons", mapping);
+    std::reverse(tokens.begin(), tokens.end()); // want lowest bits first
+
+    colMask = rankMask = bankMask = 0;
+    uint32_t startBit = 0;
+    auto computeShiftAndMask = [&startBit, mapping](const std::string& field, const uint32_t fieldBits, uint32_t& shift, uint32_t& mask) {
+        if (mask) panic("Repeated field %s in addrMapping %s", field.c_str(), mapping);
+        shift = startBit;
+        mask = (1 << fieldBits) - 1;
+        startBit += fieldBits;
+    };
+    for (auto t : tokens) {
+        if (t == "col")       computeShiftAndMask(t, colBits,  colShift,  colMask);
+        else if (t == "rank") computeShiftAndMask(t, rankBits, rankShift, rankMask);
+        else if (t == "bank") computeShiftAndMask(t, bankBits, bankShift, bankMask);
+        else panic("Invalid token %s in addrMapping %s (only row/col/rank)", t.c_str(), mapping);
+    }
+    rowShift = startBit;  // row has no mask
+
+    rankHash.init(hash, rankBits);
+    bankHash.init(hash, bankBits);
+}
+
+void DRAMAddrMapping::print(const char* name, const char* mapping) const {
+    info("%s: Address mapping %s row %d:%ld col %d:%d rank %d:%d bank %d:%d, %s bank hash",
+            name, mapping, 63, rowShift, ilog2(colMask << colShift), colShift,
+            ilog2(rankMask << rankShift), rankShift, ilog2(bankMask << bankShift), bankShift, bankHash.name());
+}
+
+void ChannelMapping::init(uint32_t _channels, const char* hashType) {
+    channels = _channels;
+    hash.init(hashType, ilog2(channels));
+    if (hash.getType() != AddrHash::NONE && !isPow2(channels)) {
+        panic("Channel hashing needs a power-of-2 number of channels, got %d", channels);
+    }
+}
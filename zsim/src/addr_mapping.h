@@ -0,0 +1,141 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ADDR_MAPPING_H_
+#define ADDR_MAPPING_H_
+
+#include <stdint.h>
+#include "log.h"
+//#include "memory_hierarchy.h"
+#include "phase_concurrent_memory_hierarchy.h"
+
+/* Index hashing, to spread strided accesses that plain interleaving maps to a
+ * few banks or channels. The index is XORed with bits taken from the part of
+ * the address above it:
+ *  - None: plain interleaving.
+ *  - XOR: all the upper bits, folded in index-sized chunks.
+ *  - Permutation: only the lowest index-sized chunk. For banks, these are the
+ *    row's low bits, i.e., permutation-based page interleaving (Zhang et al.,
+ *    MICRO 2000): the same bank index maps to a different bank in each row.
+ * Since the upper bits are kept as they are, both hashes are bijective and
+ * never alias two lines.
+ */
+class AddrHash {
+    public:
+        typedef enum {
+            NONE,
+            XOR,
+            PERMUTATION
+        } Type;
+
+    private:
+        Type type;
+        uint64_t mask;
+        uint32_t bits;
+
+    public:
+        AddrHash() : type(NONE), mask(0), bits(0) {}
+
+        void init(const char* typeStr, uint32_t _bits);
+
+        inline Type getType() const {return type;}
+        const char* name() const {
+            return (type == NONE)? "None" : (type == XOR)? "XOR" : "Permutation";
+        }
+
+        inline uint32_t hash(uint32_t index, uint64_t upper) const {
+            if (type == NONE || bits == 0) return index;
+            if (type == PERMUTATION) return index ^ (upper & mask);
+            uint64_t h = 0;
+            while (upper) {
+                h ^= upper & mask;
+                upper >>= bits;
+            }
+            return index ^ h;
+        }
+};
+
+struct DRAMAddrLoc {
+    uint64_t row;
+    uint32_t bank;
+    uint32_t rank;
+    uint32_t col;
+};
+
+/* Splits a channel's line addresses into row, column, rank and bank. The field
+ * order is given by a string like "rank:col:bank" (MSB to LSB, row is always
+ * on top), and rank and bank indices can be hashed with the row.
+ */
+class DRAMAddrMapping {
+    private:
+        uint32_t colShift, colMask;
+        uint32_t rankShift, rankMask;
+        uint32_t bankShift, bankMask;
+        uint64_t rowShift;  // row's always top
+        AddrHash rankHash, bankHash;
+
+    public:
+        // pageSize is in bytes; as in DDRMemory, a page has pageSize/8 bursts of a 64-bit bus
+        void init(const char* mapping, const char* hash, uint32_t lineSize, uint32_t pageSize,
+                uint32_t ranksPerChannel, uint32_t banksPerRank);
+
+        inline DRAMAddrLoc map(Address lineAddr) const {
+            DRAMAddrLoc l;
+            l.col  = (lineAddr >> colShift)  & colMask;
+            l.row  = lineAddr >> rowShift;
+            l.rank = rankHash.hash((lineAddr >> rankShift) & rankMask, l.row);
+            l.bank = bankHash.hash((lineAddr >> bankShift) & bankMask, l.row);
+            return l;
+        }
+
+        void print(const char* name, const char* mapping) const;
+};
+
+/* Splits line addresses across channels (memory controllers), and gives each
+ * controller a dense address space. Unhashed, this is plain interleaving, which
+ * works with any number of channels; hashing needs a power of 2.
+ */
+class ChannelMapping {
+    private:
+        uint32_t channels;
+        AddrHash hash;
+
+    public:
+        ChannelMapping() : channels(1) {}
+
+        void init(uint32_t _channels, const char* hashType);
+
+        inline uint32_t channel(Address lineAddr) const {
+            return hash.hash(lineAddr % channels, lineAddr / channels);
+        }
+
+        inline Address ctrlAddr(Address lineAddr) const {
+            return lineAddr / channels;
+        }
+
+        const char* hashName() const {return hash.name();}
+};
+
+#endif  // ADDR_MAPPING_H_
@@ -10,7 +10,7 @@ class DirtyReplPolicy : public virtual ReplPolicy, public DynamicPartMapper {
     }
 
     bool isDirty(uint32_t id) {
-        return cc->isDirty(id);
+        return isDirtyLine(id);
     }
 
     void initStats(AggregateStat* parent) {
@@ -97,7 +97,7 @@ class AsymSRRIPReplPolicy : public SRRIPReplPolicy {
                 }
                 profInsertions.inc();
             } else {
-                bool dirty = cc->isDirty(id);//dirty_array[id];
+                bool dirty = isDirtyLine(id);//dirty_array[id];
                 //This needs to check if the item is currently dirty or is being written to, not just the latter
                 if (dirty){
                     changePrio(id, dprom); //predict near-immediate re-reference
@@ -31,7 +31,7 @@
 #include "zsim.h"
 
 Cache::Cache(uint32_t _numLines, CC* _cc, CacheArray* _array, ReplPolicy* _rp, uint32_t _accLat, uint32_t _invLat, const g_string& _name)
-    : cc(_cc), array(_array), rp(_rp), numLines(_numLines), accLat(_accLat), invLat(_invLat), name(_name) {}
+    : cc(_cc), array(_array), rp(_rp), numLines(_numLines), accLat(_accLat), invLat(_invLat), name(_name), lastEvictedLineAddr(0) {}
 
 const char* Cache::getName() {
     return name.c_str();
@@ -60,6 +60,7 @@ void Cache::initCacheStats(AggregateStat* cacheStat) {
 
 uint64_t Cache::access(MemReq& req) {
     uint64_t respCycle = req.cycle;
+    lastEvictedLineAddr = 0;
     bool skipAccess = cc->startAccess(req); //may need to skip access due to races (NOTE: may change req.type!)
     if (likely(!skipAccess)) {
 //        bool updateReplacement = (req.type == GETS) || (req.type == GETX);
@@ -78,45 +79,15 @@ uint64_t Cache::access(MemReq& req) {
             cc->processEviction(req, wbLineAddr, lineId, respCycle); //1. if needed, send invalidates/downgrades to lower level
 
             array->postinsert(req.lineAddr, &req, lineId); //do the actual insertion. NOTE: Now we must split insert into a 2-phase thing because cc unlocks us.
+            lastEvictedLineAddr = wbLineAddr;
         }
         // Enforce single-record invariant: Writeback access may have a timing
         // record. If so, read it.
-        EventRecorder* evRec = zinfo->eventRecorders[req.srcId];
-        TimingRecord wbAcc;
-        wbAcc.clear();
-        if (unlikely(evRec && evRec->hasRecord())) {
-            wbAcc = evRec->popRecord();
-        }
+        TimingRecord wbAcc = popWritebackRecord(req);
 
         respCycle = cc->processAccess(req, lineId, respCycle);
 
-        // Access may have generated another timing record. If *both* access
-        // and wb have records, stitch them together
-        if (unlikely(wbAcc.isValid())) {
-            if (!evRec->hasRecord()) {
-                // Downstream should not care about endEvent for PUTs
-                wbAcc.endEvent = nullptr;
-                evRec->pushRecord(wbAcc);
-            } else {
-                // Connect both events
-                TimingRecord acc = evRec->popRecord();
-                assert(wbAcc.reqCycle >= req.cycle);
-                assert(acc.reqCycle >= req.cycle);
-                DelayEvent* startEv = new (evRec) DelayEvent(0);
-                DelayEvent* dWbEv = new (evRec) DelayEvent(wbAcc.reqCycle - req.cycle);
-                DelayEvent* dAccEv = new (evRec) DelayEvent(acc.reqCycle - req.cycle);
-                startEv->setMinStartCycle(req.cycle);
-                dWbEv->setMinStartCycle(req.cycle);
-                dAccEv->setMinStartCycle(req.cycle);
-                startEv->addChild(dWbEv, evRec)->addChild(wbAcc.startEvent, evRec);
-                startEv->addChild(dAccEv, evRec)->addChild(acc.startEvent, evRec);
-
-                acc.reqCycle = req.cycle;
-                acc.startEvent = startEv;
-                // endEvent / endCycle stay the same; wbAcc's endEvent not connected
-                evRec->pushRecord(acc);
-            }
-        }
+        mergeWritebackRecord(req, wbAcc);
     }
 
     cc->endAccess(req);
@@ -127,13 +98,127 @@ uint64_t Cache::access(MemReq& req) {
     return respCycle;
 }
 
+TimingRecord Cache::popWritebackRecord(const MemReq& req) {
+    EventRecorder* evRec = zinfo->eventRecorders[req.srcId];
+    TimingRecord wbAcc;
+    wbAcc.clear();
+    if (unlikely(evRec && evRec->hasRecord())) {
+        wbAcc = evRec->popRecord();
+    }
+    return wbAcc;
+}
+
+void Cache::mergeWritebackRecord(const MemReq& req, TimingRecord& wbAcc) {
+    // Access may have generated another timing record. If *both* access
+    // and wb have records, stitch them together
+    if (unlikely(wbAcc.isValid())) {
+        EventRecorder* evRec = zinfo->eventRecorders[req.srcId];
+        if (!evRec->hasRecord()) {
+            // Downstream should not care about endEvent for PUTs
+            wbAcc.endEvent = nullptr;
+            evRec->pushRecord(wbAcc);
+        } else {
+            // Connect both events
+            TimingRecord acc = evRec->popRecord();
+            assert(wbAcc.reqCycle >= req.cycle);
+            assert(acc.reqCycle >= req.cycle);
+            DelayEvent* startEv = new (evRec) DelayEvent(0);
+            DelayEvent* dWbEv = new (evRec) DelayEvent(wbAcc.reqCycle - req.cycle);
+            DelayEvent* dAccEv = new (evRec) DelayEvent(acc.reqCycle - req.cycle);
+            startEv->setMinStartCycle(req.cycle);
+            dWbEv->setMinStartCycle(req.cycle);
+            dAccEv->setMinStartCycle(req.cycle);
+            startEv->addChild(dWbEv, evRec)->addChild(wbAcc.startEvent, evRec);
+            startEv->addChild(dAccEv, evRec)->addChild(acc.startEvent, evRec);
+
+            acc.reqCycle = req.cycle;
+            acc.startEvent = startEv;
+            // endEvent / endCycle stay the same; wbAcc's endEvent not connected
+            evRec->pushRecord(acc);
+        }
+    }
+}
+
+/* Phase barriers are issued by the core on its private caches, bottom-up (see FilterCache::barrier).
+ * All the messages a cache sends on a barrier go out in parallel, so the barrier finishes when the
+ * slowest one is acknowledged. Weave-phase records of the writebacks are merged into a single PUT
+ * record, together with any record left by the previous (lower) level.
+ */
+uint64_t Cache::barrier(uint64_t startCycle, uint32_t srcId) {
+    EventRecorder* evRec = zinfo->eventRecorders[srcId];
+    TimingRecord prevBar;
+    prevBar.clear();
+    if (unlikely(evRec && evRec->hasRecord())) {
+        prevBar = evRec->popRecord();
+    }
+
+    uint64_t respCycle = startCycle;
+    Address firstAddr = 0;
+    DelayEvent* startEv = nullptr;
+
+    cc->startBarrier();
+    g_vector<uint32_t> lineIds;
+    cc->getBarrierLines(lineIds); //only the lines that transition, not the whole array
+    for (uint32_t lineId : lineIds) {
+        Address lineAddr = array->getLineAddr(lineId);
+        uint64_t lineCycle = cc->processBarrier(lineAddr, lineId, startCycle, srcId);
+        respCycle = MAX(respCycle, lineCycle);
+
+        if (unlikely(evRec && evRec->hasRecord())) {
+            TimingRecord wbAcc = evRec->popRecord();
+            assert(wbAcc.reqCycle >= startCycle);
+            if (!startEv) {
+                startEv = new (evRec) DelayEvent(0);
+                startEv->setMinStartCycle(startCycle);
+                firstAddr = lineAddr;
+            }
+            DelayEvent* dWbEv = new (evRec) DelayEvent(wbAcc.reqCycle - startCycle);
+            dWbEv->setMinStartCycle(startCycle);
+            startEv->addChild(dWbEv, evRec)->addChild(wbAcc.startEvent, evRec);
+        }
+    }
+    cc->endBarrier();
+
+    if (startEv) {
+        TimingRecord bar;
+        bar.addr = firstAddr;
+        bar.reqCycle = startCycle;
+        bar.respCycle = respCycle;
+        bar.type = PUTX;
+        bar.startEvent = startEv;
+        bar.endEvent = nullptr; //like any PUT, nothing downstream waits on it
+
+        if (prevBar.isValid()) {
+            // Connect both barriers
+            assert(startCycle >= prevBar.reqCycle);
+            DelayEvent* rootEv = new (evRec) DelayEvent(0);
+            DelayEvent* dPrevEv = new (evRec) DelayEvent(0);
+            DelayEvent* dBarEv = new (evRec) DelayEvent(startCycle - prevBar.reqCycle);
+            rootEv->setMinStartCycle(prevBar.reqCycle);
+            dPrevEv->setMinStartCycle(prevBar.reqCycle);
+            dBarEv->setMinStartCycle(prevBar.reqCycle);
+            rootEv->addChild(dPrevEv, evRec)->addChild(prevBar.startEvent, evRec);
+            rootEv->addChild(dBarEv, evRec)->addChild(startEv, evRec);
+
+            bar.addr = prevBar.addr;
+            bar.reqCycle = prevBar.reqCycle;
+            bar.startEvent = rootEv;
+        }
+        evRec->pushRecord(bar);
+    } else if (prevBar.isValid()) {
+        evRec->pushRecord(prevBar);
+    }
+
+    return respCycle;
+}
+
 void Cache::startInvalidate() {
     cc->startInv(); //note we don't grab tcc; tcc serializes multiple up accesses, down accesses don't see it
 }
 
 uint64_t Cache::finishInvalidate(const InvReq& req) {
     int32_t lineId = array->lookup(req.lineAddr, nullptr, false);
-    assert_msg(lineId != -1, "[%s] Invalidate on non-existing address 0x%lx type %s lineId %d, reqWriteback %d", name.c_str(), req.lineAddr, InvTypeName(req.type), lineId, *req.writeback);
+    assert_msg(lineId != -1 || req.mayMiss, "[%s] Invalidate on non-existing address 0x%lx type %s lineId %d, reqWriteback %d", name.c_str(), req.lineAddr, InvTypeName(req.type), lineId, *req.writeback);
     uint64_t respCycle = req.cycle + invLat;
     trace(Cache, "[%s] Invalidate start 0x%lx type %s lineId %d, reqWriteback %d", name.c_str(), req.lineAddr, InvTypeName(req.type), lineId, *req.writeback);
     respCycle = cc->processInv(req, lineId, respCycle); //send invalidates or downgrades to children, and adjust our own state
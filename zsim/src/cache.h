@@ -37,11 +37,12 @@
 #include "stats.h"
 
 class Network;
+struct TimingRecord;
 
 /* General coherent modular cache. The replacement policy and cache array are
  * pretty much mix and match. The coherence controller interfaces are general
- * too, but to avoid virtual function call overheads we work with MESI
- * controllers, since for now we only have MESI controllers
+ * too. Every call to them is virtual here; CacheImpl (cache_impl.h) specializes
+ * the access path for the common combinations to avoid those overheads.
  */
 class Cache : public BaseCache {
     protected:
@@ -57,6 +58,8 @@ class Cache : public BaseCache {
 
         g_string name;
 
+        Address lastEvictedLineAddr; //line replaced by the last access(), 0 if it did not allocate
+
     public:
         Cache(uint32_t _numLines, CC* _cc, CacheArray* _array, ReplPolicy* _rp, uint32_t _accLat, uint32_t _invLat, const g_string& _name);
 
@@ -73,9 +76,22 @@ class Cache : public BaseCache {
             return finishInvalidate(req);
         }
 
+        //Only valid right after access(), and while the caller holds the lock it passed in req.childLock
+        Address getLastEvictedLineAddr() const {return lastEvictedLineAddr;}
+
+        //Stats specific to this type of cache, without the cc/array/repl ones (see FilterCache, which reuses a cache's miss path)
+        virtual void initExtraStats(AggregateStat* cacheStat) {}
+
+        //Phase barrier: self-downgrades every line of this cache. Returns the cycle where all resulting messages are acknowledged
+        uint64_t barrier(uint64_t startCycle, uint32_t srcId);
+
     protected:
         void initCacheStats(AggregateStat* cacheStat);
 
+        //Weave-phase records of the writeback an access may cause, and of the access itself, are merged into one
+        TimingRecord popWritebackRecord(const MemReq& req); //call before cc->processAccess()
+        void mergeWritebackRecord(const MemReq& req, TimingRecord& wbAcc); //call after it
+
         void startInvalidate(); // grabs cc's downLock
         uint64_t finishInvalidate(const InvReq& req); // performs inv and releases downLock
 };
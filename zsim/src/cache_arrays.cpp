@@ -34,22 +34,18 @@ SetAssocArray::SetAssocArray(uint32_t _numLines, uint32_t _assoc, ReplPolicy* _r
     numSets = numLines/assoc;
     setMask = numSets - 1;
     assert_msg(isPow2(numSets), "must have a power of 2 # sets, but you specified %d", numSets);
+    //Unhashed arrays are the common case; skip the virtual call for them on every access
+    idHash = (dynamic_cast<IdHashFamily*>(hf) != nullptr);
 }
 
 int32_t SetAssocArray::lookup(const Address lineAddr, const MemReq* req, bool updateReplacement) {
-    uint32_t set = hf->hash(0, lineAddr) & setMask;
-    uint32_t first = set*assoc;
-    for (uint32_t id = first; id < first + assoc; id++) {
-        if (array[id] ==  lineAddr) {
-            if (updateReplacement) rp->update(id, req);
-            return id;
-        }
-    }
-    return -1;
+    int32_t id = find(lineAddr);
+    if (id != -1 && updateReplacement) rp->update(id, req);
+    return id;
 }
 
 uint32_t SetAssocArray::preinsert(const Address lineAddr, const MemReq* req, Address* wbLineAddr) { //TODO: Give out valid bit of wb cand?
-    uint32_t set = hf->hash(0, lineAddr) & setMask;
+    uint32_t set = setOf(lineAddr);
     uint32_t first = set*assoc;
 
     uint32_t candidate = rp->rankCands(req, SetAssocCands(first, first+assoc));
@@ -85,6 +81,11 @@ ZArray::ZArray(uint32_t _numLines, uint32_t _ways, uint32_t _candidates, ReplPol
         lookupArray[i] = i;  // start with a linear mapping; with swaps, it'll get progressively scrambled
     }
     swapArray = gm_calloc<uint32_t>(cands/ways + 2);  // conservative upper bound (tight within 2 ways)
+
+    //Lines start invalid (address 0), and their positions are only read once they are valid
+    posArray = gm_calloc<uint32_t>((uint64_t)numLines*ways);
+    insertPos = gm_calloc<uint32_t>(ways);
+    insertAddr = 0;
 }
 
 void ZArray::initStats(AggregateStat* parentStat) {
@@ -103,8 +104,10 @@ int32_t ZArray::lookup(const Address lineAddr, const MemReq* req, bool updateRep
      */
     if (unlikely(!lineAddr)) panic("ZArray::lookup called with lineAddr==0 -- your app just segfaulted");
 
+    uint64_t hashes[ways];
+    hf->hashAll(lineAddr, hashes, ways);
     for (uint32_t w = 0; w < ways; w++) {
-        uint32_t lineId = lookupArray[w*numSets + (hf->hash(w, lineAddr) & setMask)];
+        uint32_t lineId = lookupArray[w*numSets + (hashes[w] & setMask)];
         if (array[lineId] == lineAddr) {
             if (updateReplacement) {
                 rp->update(lineId, req);
@@ -125,23 +128,27 @@ uint32_t ZArray::preinsert(const Address lineAddr, const MemReq* req, Address* w
     //info("Replacement for incoming 0x%lx", lineAddr);
 
     //Seeds
+    computePositions(lineAddr, insertPos);
+    insertAddr = lineAddr;
     for (uint32_t w = 0; w < ways; w++) {
-        uint32_t pos = w*numSets + (hf->hash(w, lineAddr) & setMask);
+        uint32_t pos = insertPos[w];
         uint32_t lineId = lookupArray[pos];
         candidates[w].set(pos, lineId, -1);
         all_valid &= (array[lineId] != 0);
+        __builtin_prefetch(&posArray[lineId*ways]);
         //info("Seed Candidate %d addr 0x%lx pos %d lineId %d", w, array[lineId], pos, lineId);
     }
 
-    //Expand fringe in BFS fashion
+    //Expand fringe in BFS fashion. Each line's positions were cached on insertion, so this does no hashing,
+    //and we prefetch the positions of every candidate we add, since the next level of the tree reads them
     while (numCandidates < cands && all_valid) {
         uint32_t fringeId = candidates[fringeStart].lineId;
-        Address fringeAddr = array[fringeId];
-        assert(fringeAddr);
+        assert(array[fringeId]);
+        const uint32_t* fringePos = &posArray[fringeId*ways];
         for (uint32_t w = 0; w < ways; w++) {
-            uint32_t hval = hf->hash(w, fringeAddr) & setMask;
-            uint32_t pos = w*numSets + hval;
+            uint32_t pos = fringePos[w];
             uint32_t lineId = lookupArray[pos];
+            __builtin_prefetch(&posArray[lineId*ways]);
 
             // Logically, you want to do this...
 #if 0
@@ -213,6 +220,14 @@ void ZArray::postinsert(const Address lineAddr, const MemReq* req, uint32_t cand
     array[candidate] = lineAddr;
     rp->update(candidate, req);
 
+    //Cache the new line's positions for future walks (preinsert() already computed them, unless someone preinserted in between)
+    uint32_t* pos = &posArray[candidate*ways];
+    if (likely(insertAddr == lineAddr)) {
+        for (uint32_t w = 0; w < ways; w++) pos[w] = insertPos[w];
+    } else {
+        computePositions(lineAddr, pos);
+    }
+
     statSwaps.inc(swapArrayLen-1);
 }
 
@@ -29,6 +29,11 @@
 //#include "memory_hierarchy.h"
 #include "phase_concurrent_memory_hierarchy.h"
 #include "stats.h"
+#include "hash.h"
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
 
 /* General interface of a cache array. The array is a fixed-size associative container that
  * translates addresses to line IDs. A line ID represents the position of the tag. The other
@@ -49,11 +54,44 @@ class CacheArray : public GlobAlloc {
          */
         virtual void postinsert(const Address lineAddr, const MemReq* req, uint32_t lineId) = 0;
 
+        /* Returns the address of the line currently held in lineId. Used to walk the array (e.g., on phase barriers) */
+        virtual Address getLineAddr(uint32_t lineId) = 0;
+
         virtual void initStats(AggregateStat* parent) {}
 };
 
 class ReplPolicy;
-class HashFamily;
+
+/* Returns the index of the first of the n tags that equals tag, or -1 if none does.
+ *
+ * This is the hottest loop in the simulator for highly-associative L2s and LLCs, so with
+ * -march=haswell (AVX2) we compare 4 ways per instruction, and with AVX-512 we compare 8.
+ * The tail of sets that are not a multiple of the vector width, and builds for older
+ * targets (the default -march=core2 has no 64-bit vector compare), use the scalar loop.
+ * Lines are unique within a set, so "first" and "only" are the same.
+ */
+inline int32_t matchTag(const Address* tags, uint32_t n, Address tag) {
+    uint32_t i = 0;
+#if defined(__AVX512F__)
+    __m512i key8 = _mm512_set1_epi64(tag);
+    for (; i + 8 <= n; i += 8) {
+        __mmask8 m = _mm512_cmpeq_epi64_mask(_mm512_loadu_si512((const void*)&tags[i]), key8);
+        if (m) return i + __builtin_ctz(m);
+    }
+#endif
+#if defined(__AVX2__)
+    __m256i key4 = _mm256_set1_epi64x(tag);
+    for (; i + 4 <= n; i += 4) {
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)&tags[i]), key4);
+        uint32_t m = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        if (m) return i + __builtin_ctz(m);
+    }
+#endif
+    for (; i < n; i++) {
+        if (tags[i] == tag) return i;
+    }
+    return -1;
+}
 
 /* Set-associative cache array */
 class SetAssocArray : public CacheArray {
@@ -65,6 +103,17 @@ class SetAssocArray : public CacheArray {
         uint32_t numSets;
         uint32_t assoc;
         uint32_t setMask;
+        bool idHash; //hf is an IdHashFamily, so the set index is just the low bits of the address
+
+        inline uint32_t setOf(const Address lineAddr) const {
+            return (idHash? lineAddr : hf->hash(0, lineAddr)) & setMask;
+        }
+
+        inline int32_t find(const Address lineAddr) const {
+            uint32_t first = setOf(lineAddr)*assoc;
+            int32_t way = matchTag(&array[first], assoc, lineAddr);
+            return (way == -1)? -1 : (int32_t)(first + way);
+        }
 
     public:
         SetAssocArray(uint32_t _numLines, uint32_t _assoc, ReplPolicy* _rp, HashFamily* _hf);
@@ -72,6 +121,16 @@ class SetAssocArray : public CacheArray {
         int32_t lookup(const Address lineAddr, const MemReq* req, bool updateReplacement);
         uint32_t preinsert(const Address lineAddr, const MemReq* req, Address* wbLineAddr);
         void postinsert(const Address lineAddr, const MemReq* req, uint32_t candidate);
+
+        Address getLineAddr(uint32_t lineId) {return array[lineId];}
+
+        /* Same as lookup/preinsert/postinsert, but take the replacement policy with its concrete
+         * type R, so the calls into it are resolved statically. r must be the array's own policy.
+         * Used by CacheImpl (see cache_impl.h).
+         */
+        template <class R> inline int32_t lookupAs(R* r, const Address lineAddr, const MemReq* req, bool updateReplacement);
+        template <class R> inline uint32_t preinsertAs(R* r, const Address lineAddr, const MemReq* req, Address* wbLineAddr);
+        template <class R> inline void postinsertAs(R* r, const Address lineAddr, const MemReq* req, uint32_t candidate);
 };
 
 /* The cache array that started this simulator :) */
@@ -79,6 +138,7 @@ class ZArray : public CacheArray {
     private:
         Address* array; //maps line id to address
         uint32_t* lookupArray; //maps physical position to lineId
+        uint32_t* posArray; //maps line id to the positions of its address in each way (ways entries per line), so walks don't hash
         ReplPolicy* rp;
         HashFamily* hf;
         uint32_t numLines;
@@ -93,6 +153,16 @@ class ZArray : public CacheArray {
 
         uint32_t lastCandIdx;
 
+        //Positions of the line being inserted, computed in preinsert() and reused by postinsert()
+        Address insertAddr;
+        uint32_t* insertPos;
+
+        inline void computePositions(Address lineAddr, uint32_t* pos) {
+            uint64_t hashes[ways];
+            hf->hashAll(lineAddr, hashes, ways);
+            for (uint32_t w = 0; w < ways; w++) pos[w] = w*numSets + (hashes[w] & setMask);
+        }
+
         Counter statSwaps;
 
     public:
@@ -102,6 +172,8 @@ class ZArray : public CacheArray {
         uint32_t preinsert(const Address lineAddr, const MemReq* req, Address* wbLineAddr);
         void postinsert(const Address lineAddr, const MemReq* req, uint32_t candidate);
 
+        Address getLineAddr(uint32_t lineId) {return array[lineId];}
+
         //zcache-specific, since timing code needs to know the number of swaps, and these depend on idx
         //Should be called after preinsert(). Allows intervening lookups
         uint32_t getLastCandIdx() const {return lastCandIdx;}
@@ -181,4 +253,23 @@ struct ArrayCands {
     inline uint32_t numCands() const { return iSize; }
 };
 
+template <class R> inline int32_t SetAssocArray::lookupAs(R* r, const Address lineAddr, const MemReq* req, bool updateReplacement) {
+    int32_t id = find(lineAddr);
+    if (id != -1 && updateReplacement) r->R::update(id, req);
+    return id;
+}
+
+template <class R> inline uint32_t SetAssocArray::preinsertAs(R* r, const Address lineAddr, const MemReq* req, Address* wbLineAddr) {
+    uint32_t first = setOf(lineAddr)*assoc;
+    uint32_t candidate = r->R::rankCands(req, SetAssocCands(first, first+assoc));
+    *wbLineAddr = array[candidate];
+    return candidate;
+}
+
+template <class R> inline void SetAssocArray::postinsertAs(R* r, const Address lineAddr, const MemReq* req, uint32_t candidate) {
+    r->R::replaced(candidate);
+    array[candidate] = lineAddr;
+    r->R::update(candidate, req);
+}
+
 #endif  // CACHE_ARRAYS_H_
@@ -0,0 +1,103 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CACHE_IMPL_H_
+#define CACHE_IMPL_H_
+
+#include <typeinfo>
+#include "cache.h"
+#include "event_recorder.h"
+#include "log.h"
+
+/* Cache with its array, replacement policy and coherence controller fixed at compile time.
+ *
+ * Cache::access makes about a dozen virtual calls per access (CC, array and replacement
+ * policy). For the common combinations, BuildCacheBank instantiates this instead, which
+ * runs the same access path with every one of those calls bound statically, so they can be
+ * inlined. The types must be the exact dynamic types of the components (not base classes),
+ * since a derived policy could override any of the methods we bind. Everything else
+ * (invalidations, barriers, stats) goes through Cache unchanged.
+ *
+ * For now, A can only be SetAssocArray, which exposes the typed insertion interface we need.
+ */
+template <class A, class R, class C>
+class CacheImpl : public Cache {
+    protected:
+        A* typedArray;
+        R* typedRP;
+        C* typedCC;
+
+    public:
+        CacheImpl(uint32_t _numLines, CC* _cc, CacheArray* _array, ReplPolicy* _rp, uint32_t _accLat, uint32_t _invLat, const g_string& _name)
+            : Cache(_numLines, _cc, _array, _rp, _accLat, _invLat, _name)
+        {
+            //dynamic_cast, since some policies derive virtually from ReplPolicy
+            typedArray = dynamic_cast<A*>(_array);
+            typedRP = dynamic_cast<R*>(_rp);
+            typedCC = dynamic_cast<C*>(_cc);
+            if (!typedArray || typeid(*_array) != typeid(A) || !typedRP || typeid(*_rp) != typeid(R) || !typedCC || typeid(*_cc) != typeid(C)) {
+                panic("[%s] CacheImpl instantiated with the wrong component types", name.c_str());
+            }
+        }
+
+        uint64_t access(MemReq& req) {
+            return CacheImpl::accessImpl(req);
+        }
+
+    protected:
+        //Same as Cache::access, see the comments there
+        inline uint64_t accessImpl(MemReq& req) {
+            uint64_t respCycle = req.cycle;
+            lastEvictedLineAddr = 0;
+            bool skipAccess = typedCC->C::startAccess(req);
+            if (likely(!skipAccess)) {
+                bool updateReplacement = true;
+                int32_t lineId = typedArray->lookupAs(typedRP, req.lineAddr, &req, updateReplacement);
+                respCycle += accLat;
+
+                if (lineId == -1 && typedCC->C::shouldAllocate(req)) {
+                    Address wbLineAddr;
+                    lineId = typedArray->preinsertAs(typedRP, req.lineAddr, &req, &wbLineAddr);
+                    trace(Cache, "[%s] Evicting 0x%lx", name.c_str(), wbLineAddr);
+                    typedCC->C::processEviction(req, wbLineAddr, lineId, respCycle);
+                    typedArray->postinsertAs(typedRP, req.lineAddr, &req, lineId);
+                    lastEvictedLineAddr = wbLineAddr;
+                }
+
+                TimingRecord wbAcc = popWritebackRecord(req);
+                respCycle = typedCC->C::processAccess(req, lineId, respCycle);
+                mergeWritebackRecord(req, wbAcc);
+            }
+
+            typedCC->C::endAccess(req);
+
+            assert_msg(respCycle >= req.cycle, "[%s] resp < req? 0x%lx type %s childState %s, respCycle %ld reqCycle %ld",
+                    name.c_str(), req.lineAddr, AccessTypeName(req.type), DCWSOLIStateName(*req.state), respCycle, req.cycle);
+            return respCycle;
+        }
+};
+
+#endif  // CACHE_IMPL_H_
@@ -84,6 +84,9 @@ class Core : public GlobAlloc {
         virtual void leave() {}
         virtual void join() {}
 
+        //Called on a phase barrier magic op; cores with caches self-downgrade their private hierarchy
+        virtual void phaseBarrier() {}
+
         virtual InstrFuncPtrs GetFuncPtrs() = 0;
 };
 
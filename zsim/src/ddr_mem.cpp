@@ -28,7 +28,6 @@
 #include <string>
 #include <vector>
 #include "bithacks.h"
-#include "config.h"  // for Tokenize
 #include "contention_sim.h"
 #include "event_recorder.h"
 #include "timing_event.h"
@@ -43,13 +42,15 @@ class DDRMemoryAccEvent : public TimingEvent {
         DDRMemory* mem;
         Address addr;
         bool write;
+        uint32_t srcId;
 
     public:
-        DDRMemoryAccEvent(DDRMemory* _mem, bool _isWrite, Address _addr, int32_t domain, uint32_t preDelay, uint32_t postDelay)
-            : TimingEvent(preDelay, postDelay, domain), mem(_mem), addr(_addr), write(_isWrite) {}
+        DDRMemoryAccEvent(DDRMemory* _mem, bool _isWrite, Address _addr, uint32_t _srcId, int32_t domain, uint32_t preDelay, uint32_t postDelay)
+            : TimingEvent(preDelay, postDelay, domain), mem(_mem), addr(_addr), write(_isWrite), srcId(_srcId) {}
 
         Address getAddr() const {return addr;}
         bool isWrite() const {return write;}
+        uint32_t getSrcId() const {return srcId;}
 
         void simulate(uint64_t startCycle) {
             mem->enqueue(this, startCycle);
@@ -151,12 +152,12 @@ class SchedEvent : public TimingEvent, public GlobAlloc {
 /* Init & bound phase functionality */
 
 DDRMemory::DDRMemory(uint32_t _lineSize, uint32_t _colSize, uint32_t _ranksPerChannel, uint32_t _banksPerRank,
-        uint32_t _sysFreqMHz, const char* tech, const char* addrMapping, uint32_t _controllerSysLatency,
-                     uint32_t _queueDepth, uint32_t _rowHitLimit, bool _deferredWrites, bool _closedPage,
-                     bool _isNVM, uint32_t _domain, g_string& _name)
+        uint32_t _sysFreqMHz, const char* tech, const char* addrMapping, const char* bankHash, uint32_t _controllerSysLatency,
+                     uint32_t _queueDepth, uint32_t _wrQueueDepth, uint32_t _rowHitLimit, bool _deferredWrites, bool _batchWrites,
+                     bool _closedPage, bool _isNVM, const char* schedPolicy, uint32_t _wrBurstRate, uint32_t _domain, g_string& _name)
     : lineSize(_lineSize), ranksPerChannel(_ranksPerChannel), banksPerRank(_banksPerRank),
-      controllerSysLatency(_controllerSysLatency), queueDepth(_queueDepth), rowHitLimit(_rowHitLimit),
-      deferredWrites(_deferredWrites), closedPage(_closedPage), isNVM(_isNVM), domain(_domain), name(_name)
+      controllerSysLatency(_controllerSysLatency), queueDepth(_queueDepth), wrQueueDepth(_wrQueueDepth), rowHitLimit(_rowHitLimit),
+      deferredWrites(_deferredWrites), batchWrites(_deferredWrites && _batchWrites), closedPage(_closedPage), isNVM(_isNVM), domain(_domain), name(_name)
 {
     sysFreqKHz = 1000 * _sysFreqMHz;
     initTech(tech);  // sets all tXX and memFreqKHz
@@ -172,10 +173,24 @@ DDRMemory::DDRMemory(uint32_t _lineSize, uint32_t _colSize, uint32_t _ranksPerCh
     postDelayWr = 0;
 
     rdQueue.init(queueDepth);
-    wrQueue.init(queueDepth);
+    wrQueue.init(wrQueueDepth);
 
-    info("%s: domain %d, %d ranks/ch %d banks/rank, tech %s, boundLat %d rd / %d wr, %s",
-         name.c_str(), domain, ranksPerChannel, banksPerRank, tech, minRdLatency, minWrLatency, isNVM? "NVM" : "DRAM");
+    // The bus drains at most one write every tBL cycles; _wrBurstRate is the % of that which counts as a burst
+    if (_wrBurstRate > 100) panic("%s: writeBurstRate is a %% of peak bandwidth, got %d", name.c_str(), _wrBurstRate);
+    burstWindow = BURST_WINDOW*tBL;
+    burstThreshold = BURST_WINDOW*_wrBurstRate/100;
+    burstWindowEnd = 0;
+    windowWrites = 0;
+    inBurst = false;
+    draining = false;
+    drainStartCycle = 0;
+    lastCmdWasWrite = false;
+
+    sched = CreateMemSchedPolicy(schedPolicy, MAX(zinfo->numCores, 1u), ranksPerChannel*banksPerRank, rowHitLimit, tRCD+tCL+tBL);
+    arrivalOrdered = sched->isFRFCFS();
+
+    info("%s: domain %d, %d ranks/ch %d banks/rank, tech %s, boundLat %d rd / %d wr, %s, %s scheduler",
+         name.c_str(), domain, ranksPerChannel, banksPerRank, tech, minRdLatency, minWrLatency, isNVM? "NVM" : "DRAM", sched->getName());
 
     minRespCycle = tCL + tBL + 1; // We subtract tCL + tBL from this on some checks; this avoids overflows
 
@@ -187,37 +202,12 @@ DDRMemory::DDRMemory(uint32_t _lineSize, uint32_t _colSize, uint32_t _ranksPerCh
     rankActWindows.resize(ranksPerChannel);
     for (uint32_t i = 0; i < ranksPerChannel; i++) rankActWindows[i].init(4);  // we only model FAW; for TAW (other technologies) change this to 2
 
-    // We get line addresses, and for a 64-byte line, there are _colSize/(JEDEC_BUS_WIDTH/8) lines/page
-    uint32_t colBits = ilog2(_colSize/(JEDEC_BUS_WIDTH/8)*64/lineSize);
-    uint32_t bankBits = ilog2(banksPerRank);
-    uint32_t rankBits = ilog2(ranksPerChannel);
-
-    // Parse config string, has to be some combination of rank, bank, and col separated by semicolons
-    // (row is always MSB bits, since we don't actually know how many bits it is to begin with...)
-    std::vector<std::string> tokens;
-    Tokenize(addrMapping, tokens, ":");
-    if (tokens.size() != 3) panic("Invalid addrMapping %s, need all row/col/rank tokens separated by colons", addrMapping);
-    std::reverse(tokens.begin(), tokens.end()); // want lowest bits first
-
-    colMask = rankMask = bankMask = 0;
-    uint32_t startBit = 0;
-    auto computeShiftAndMask = [&startBit, addrMapping](const std::string& field, const uint32_t fieldBits, uint32_t& shift, uint32_t& mask) {
-        if (mask) panic("Repeated field %s in addrMapping %s", field.c_str(), addrMapping);
-        shift = startBit;
-        mask = (1 << fieldBits) - 1;
-        startBit += fieldBits;
-    };
-    for (auto t : tokens) {
-        if (t == "col")       computeShiftAndMask(t, colBits,  colShift,  colMask);
-        else if (t == "rank") computeShiftAndMask(t, rankBits, rankShift, rankMask);
-        else if (t == "bank") computeShiftAndMask(t, bankBits, bankShift, bankMask);
-        else panic("Invalid token %s in addrMapping %s (only row/col/rank)", t.c_str(), addrMapping);
-    }
-    rowShift = startBit;  // row has no mask
+    rdReady.init(ranksPerChannel*banksPerRank);
+    wrReady.init(ranksPerChannel*banksPerRank);
+    readyBanks.resize(ranksPerChannel*banksPerRank);
 
-    info("%s: Address mapping %s row %d:%ld col %d:%d rank %d:%d bank %d:%d",
-            name.c_str(), addrMapping, 63, rowShift, ilog2(colMask << colShift), colShift,
-            ilog2(rankMask << rankShift), rankShift, ilog2(bankMask << bankShift), bankShift);
+    addrMap.init(addrMapping, bankHash, lineSize, _colSize, ranksPerChannel, banksPerRank);
+    addrMap.print(name.c_str(), addrMapping);
 
     // Weave phase events
     if (!isNVM) {
@@ -241,6 +231,15 @@ void DDRMemory::initStats(AggregateStat* parentStat) {
     profRowBufCloses.init("rbCloses", "Row buffer closes"); memStats->append(&profRowBufCloses);
     profExpRowBufCloses.init("erbCloses", "Expensive row buffer closes"); memStats->append(&profExpRowBufCloses);
     latencyHist.init("mlh", "latency histogram for memory requests", NUMBINS); memStats->append(&latencyHist);
+    profRdOverflows.init("rdOvf", "Reads that found the read queue full"); memStats->append(&profRdOverflows);
+    profWrOverflows.init("wrOvf", "Writes that found the write queue full"); memStats->append(&profWrOverflows);
+    profWrBursts.init("wrBursts", "Write bursts detected"); memStats->append(&profWrBursts);
+    profDrains.init("drains", "Write drains that held back reads"); memStats->append(&profDrains);
+    profBurstDrains.init("burstDrains", "Write drains started during a write burst"); memStats->append(&profBurstDrains);
+    profDrainWrites.init("drainWrs", "Writes issued during drains"); memStats->append(&profDrainWrites);
+    wrOccupancyHist.init("wrOcc", "write queue occupancy histogram at write arrival, in 1/16ths of the queue", OCC_BINS); memStats->append(&wrOccupancyHist);
+    drainLatencyHist.init("drainLat", "histogram of write drain latencies (sys cycles reads are held back, 50-cycle bins)", DRAIN_NUMBINS); memStats->append(&drainLatencyHist);
+    sched->initStats(memStats);
     parentStat->append(memStats);
 }
 
@@ -269,7 +268,7 @@ uint64_t DDRMemory::access(MemReq& req) {
         uint64_t respCycle = req.cycle + (isWrite? minWrLatency : minRdLatency);
         if (zinfo->eventRecorders[req.srcId]) {
             DDRMemoryAccEvent* memEv = new (zinfo->eventRecorders[req.srcId]) DDRMemoryAccEvent(this,
-                    isWrite, req.lineAddr, domain, preDelay, isWrite? postDelayWr : postDelayRd);
+                    isWrite, req.lineAddr, req.srcId, domain, preDelay, isWrite? postDelayWr : postDelayRd);
             memEv->setMinStartCycle(req.cycle);
             TimingRecord tr = {req.lineAddr, req.cycle, respCycle, req.type, memEv, memEv};
             zinfo->eventRecorders[req.srcId]->pushRecord(tr);
@@ -279,6 +278,13 @@ uint64_t DDRMemory::access(MemReq& req) {
     }
 }
 
+//Queues are only touched in the weave phase, so bound-phase callers see a racy but harmless snapshot
+uint32_t DDRMemory::getLoad(Address lineAddr) {
+    uint32_t rdLoad = MIN(rdQueue.size(), queueDepth)*100/queueDepth;
+    uint32_t wrLoad = MIN(wrQueue.size(), wrQueueDepth)*100/wrQueueDepth;
+    return MAX(rdLoad, wrLoad);
+}
+
 /* Weave phase functionality */
 
 //Address mapping:
@@ -286,11 +292,7 @@ uint64_t DDRMemory::access(MemReq& req) {
 // NOTE: channel is external (from SplitAddrMem)
 // Change or reorder to define your own mappings
 DDRMemory::AddrLoc DDRMemory::mapLineAddr(Address lineAddr) {
-    AddrLoc l;
-    l.col  = (lineAddr >> colShift)  & colMask;
-    l.rank = (lineAddr >> rankShift) & rankMask;
-    l.bank = (lineAddr >> bankShift) & bankMask;
-    l.row  = lineAddr >> rowShift;
+    AddrLoc l = addrMap.map(lineAddr);
 
     //info("0x%lx r%ld:c%d b%d:r%d", lineAddr, l.row, l.col, l.bank, l.rank);
     assert(l.rank < ranksPerChannel);
@@ -305,13 +307,25 @@ void DDRMemory::enqueue(DDRMemoryAccEvent* ev, uint64_t sysCycle) {
 
     // Create request
     Request ovfReq;
-    bool overflow = rdQueue.full() || wrQueue.full();
     bool useWrQueue = deferredWrites && ev->isWrite();
-    Request* req = overflow? &ovfReq : useWrQueue? wrQueue.alloc() : rdQueue.alloc();
+    RequestQueue<Request>& q = useWrQueue? wrQueue : rdQueue;
+    bool overflow = q.full();
+    if (useWrQueue) {
+        updateWriteBurst(memCycle);
+        if (++windowWrites > burstThreshold && burstThreshold && !inBurst) {
+            inBurst = true;
+            profWrBursts.inc();
+        }
+        uint32_t bin = MIN(OCC_BINS - 1, wrQueue.size()*OCC_BINS/wrQueueDepth);
+        wrOccupancyHist.inc(bin, 1);
+    }
+    Request* req = overflow? &ovfReq : q.alloc();
 
     req->addr = ev->getAddr();
     req->loc = mapLineAddr(ev->getAddr());
     req->write = ev->isWrite();
+    req->si.srcId = ev->getSrcId();
+    req->si.bank = req->loc.rank*banksPerRank + req->loc.bank;
 
     req->arrivalCycle = memCycle;
     req->startSysCycle = sysCycle;
@@ -320,12 +334,18 @@ void DDRMemory::enqueue(DDRMemoryAccEvent* ev, uint64_t sysCycle) {
     ev->hold();
 
     if (overflow) {
-        overflowQueue.push_back(*req);
+        if (useWrQueue) {
+            wrOverflowQueue.push_back(*req);
+            profWrOverflows.inc();
+        } else {
+            rdOverflowQueue.push_back(*req);
+            profRdOverflows.inc();
+        }
     } else {
         queue(req, memCycle);
 
         // If needed, schedule an event to handle this new request
-        if (!req->prev /* first in bank */) {
+        if (!req->prev /* first in bank */ || !arrivalOrdered) {
             uint64_t minSchedCycle = std::max(memCycle, minRespCycle - tCL - tBL);
             if (nextSchedCycle > minSchedCycle) minSchedCycle = std::max(minSchedCycle, findMinCmdCycle(*req));
             if (nextSchedCycle > minSchedCycle) {
@@ -360,6 +380,7 @@ void DDRMemory::queue(Request* req, uint64_t memCycle) {
     }
 
     req->arrivalCycle = memCycle;  // if this comes from the overflow queue, update
+    sched->arrive(req->si, memCycle);
 
     // Test: Skip writes
 #if 0
@@ -387,10 +408,20 @@ void DDRMemory::queue(Request* req, uint64_t memCycle) {
     printQ("PRE");
 #endif
 
+    if (!arrivalOrdered) {
+        // The policy picks among all queued requests at issue time
+        req->rowHitSeq = 0;
+        q.push_back(req);
+        return;
+    }
+
+    // Writes have been acknowledged already, so there's no fairness to keep among them. With
+    // batchWrites, batch them by row without limit, which makes drains cheaper
+    uint32_t hitLimit = (batchWrites && req->write)? -1u : rowHitLimit;
     Request* m = q.back();
     while (m) {
         if (m->loc.row == req->loc.row) {
-            if (m->rowHitSeq < rowHitLimit) {
+            if (m->rowHitSeq < hitLimit) {
                 // queue after last same-row access
                 req->rowHitSeq = m->rowHitSeq + 1;
                 q.insertAfter(m, req);
@@ -406,7 +437,7 @@ void DDRMemory::queue(Request* req, uint64_t memCycle) {
 
     // No matches...
     if (!m) {
-        if (bank.open && req->loc.row == bank.openRow && bank.curRowHits < rowHitLimit && q.empty()) {
+        if (bank.open && req->loc.row == bank.openRow && bank.curRowHits < hitLimit && q.empty()) {
             // ... but row is open (& bank queue empty), bypass everyone
             /* NOTE: If the bank queue is not empty, don't go before the
              * current request. We assume that the request could have issued
@@ -426,6 +457,19 @@ void DDRMemory::queue(Request* req, uint64_t memCycle) {
 #if 0
     printQ("POST");
 #endif
+
+    if (!req->prev) {
+        // New head
+        BankReadyHeap& ready = (deferredWrites && req->write)? wrReady : rdReady;
+        ready.update(req->si.bank, findMinCmdCycle(*req));
+    }
+}
+
+void DDRMemory::updateReady(uint32_t rank, uint32_t bank) {
+    const Bank& b = banks[rank][bank];
+    uint32_t idx = rank*banksPerRank + bank;
+    rdReady.update(idx, b.rdReqs.empty()? -1ul : findMinCmdCycle(*b.rdReqs.front()));
+    wrReady.update(idx, b.wrReqs.empty()? -1ul : findMinCmdCycle(*b.wrReqs.front()));
 }
 
 // For external ticks
@@ -435,25 +479,8 @@ uint64_t DDRMemory::tick(uint64_t sysCycle) {
 
     uint64_t minSchedCycle = trySchedule(memCycle, sysCycle);
     assert(minSchedCycle >= memCycle);
-    if (!rdQueue.full() && !wrQueue.full() && !overflowQueue.empty()) {
-        Request& ovfReq = overflowQueue.front();
-        bool useWrQueue = deferredWrites && ovfReq.write;
-        Request* req = useWrQueue? wrQueue.alloc() : rdQueue.alloc();
-        *req = ovfReq;
-        overflowQueue.pop_front();
-
-        queue(req, memCycle);
-
-        // This request may be schedulable before trySchedule's minSchedCycle
-        if (!req->prev /*first in bank queue*/) {
-            uint64_t minQueuedSchedCycle = std::max(memCycle, minRespCycle - tCL - tBL);
-            if (minSchedCycle > minQueuedSchedCycle) minSchedCycle = std::max(minQueuedSchedCycle, findMinCmdCycle(*req));
-            if (minSchedCycle > minQueuedSchedCycle) {
-                DEBUG("Overflowed request lowered minSchedCycle %ld -> %ld (memCycle %ld)", minSchedCycle, minQueuedSchedCycle, memCycle);
-                minSchedCycle = minQueuedSchedCycle;
-            }
-        }
-    }
+    minSchedCycle = dequeueOverflow(rdOverflowQueue, rdQueue, memCycle, minSchedCycle);
+    minSchedCycle = dequeueOverflow(wrOverflowQueue, wrQueue, memCycle, minSchedCycle);
 
     nextSchedCycle = minSchedCycle;
     if (nextSchedCycle == -1ul) {
@@ -466,6 +493,36 @@ uint64_t DDRMemory::tick(uint64_t sysCycle) {
     }
 }
 
+// Moves the oldest overflowed request into q if there's space, and returns the updated minSchedCycle
+uint64_t DDRMemory::dequeueOverflow(std::deque<Request>& ovfQueue, RequestQueue<Request>& q, uint64_t memCycle, uint64_t minSchedCycle) {
+    if (q.full() || ovfQueue.empty()) return minSchedCycle;
+    Request* req = q.alloc();
+    *req = ovfQueue.front();
+    ovfQueue.pop_front();
+
+    queue(req, memCycle);
+
+    // This request may be schedulable before trySchedule's minSchedCycle
+    if (!req->prev /*first in bank queue*/ || !arrivalOrdered) {
+        uint64_t minQueuedSchedCycle = std::max(memCycle, minRespCycle - tCL - tBL);
+        if (minSchedCycle > minQueuedSchedCycle) minSchedCycle = std::max(minQueuedSchedCycle, findMinCmdCycle(*req));
+        if (minSchedCycle > minQueuedSchedCycle) {
+            DEBUG("Overflowed request lowered minSchedCycle %ld -> %ld (memCycle %ld)", minSchedCycle, minQueuedSchedCycle, memCycle);
+            minSchedCycle = minQueuedSchedCycle;
+        }
+    }
+    return minSchedCycle;
+}
+
+// Closes the arrival-rate window if it's over. A burst lasts while every window sees more than
+// burstThreshold writes; windows that start late (no writes for a while) count as quiet.
+void DDRMemory::updateWriteBurst(uint64_t memCycle) {
+    if (memCycle < burstWindowEnd) return;
+    inBurst = burstThreshold && windowWrites > burstThreshold && memCycle < burstWindowEnd + burstWindow;
+    windowWrites = 0;
+    burstWindowEnd = memCycle - memCycle % burstWindow + burstWindow;  // aligned, so windows don't depend on when we're called
+}
+
 void DDRMemory::recycleEvent(SchedEvent* ev) {
     assert(ev != nextSchedEvent);
     assert(ev->next == nullptr);
@@ -513,31 +570,21 @@ uint64_t DDRMemory::trySchedule(uint64_t curCycle, uint64_t sysCycle) {
     if (rdQueue.empty() && wrQueue.empty()) return -1ul;
     if (curCycle + tCL < minRespCycle) return minRespCycle - tCL;  // too far ahead
 
-    // Writes have priority if the write queue is getting full...
-    bool prioWrites = (wrQueue.size() > (3*queueDepth/4)) || (lastCmdWasWrite && wrQueue.size() > queueDepth/4);
+    // Writes have priority if the write queue is getting full, or filling up fast...
+    updateWriteBurst(curCycle);
+    uint32_t drainStartLevel = inBurst? wrQueueDepth/2 : 3*wrQueueDepth/4;
+    bool prioWrites = (wrQueue.size() > drainStartLevel) || (lastCmdWasWrite && wrQueue.size() > wrQueueDepth/4);
     bool isWriteQueue = rdQueue.empty() || prioWrites;
 
     RequestQueue<Request>& queue = isWriteQueue? wrQueue : rdQueue;
     assert(!queue.empty());
 
-    Request* r = nullptr;
-    RequestQueue<Request>::iterator ir = queue.begin();
+    Request* r;
     uint64_t minSchedCycle = -1ul;
-    while (ir != queue.end()) {
-        //Bank& bank = banks[(*ir)->loc.rank][(*ir)->loc.bank];
-        //if ((isWriteQueue? bank.wrReqs : bank.rdReqs).front() == *ir) {
-        if (!(*ir)->prev) {  // FASTAH!
-            uint64_t minCmdCycle = findMinCmdCycle(**ir);
-            minSchedCycle = std::min(minSchedCycle, minCmdCycle);
-            if (minCmdCycle <= curCycle) {
-                r = *ir;
-                break;
-            }
-            //DEBUG("Skipping 0x%lx, not ready %ld", (*ir)->ev->getAddr(), minCmdCycle);
-        } else {
-            //DEBUG("Skipping 0x%lx, not first", (*ir)->ev->getAddr());
-        }
-        ir.inc();
+    if (arrivalOrdered) {
+        r = selectReadyHead(isWriteQueue, curCycle, minSchedCycle);
+    } else {
+        r = selectRequest(queue, curCycle, minSchedCycle);
     }
 
     if (!r) {
@@ -593,6 +640,21 @@ uint64_t DDRMemory::trySchedule(uint64_t curCycle, uint64_t sysCycle) {
 
     // Figure out data bus constraints, find actual time at which command is issued
     uint64_t cmdCycle = std::max(minCmdCycle, minRespCycle - tCL);
+
+    // Track drains, i.e., writes issued while reads wait, and how long they hold reads back
+    if (r->write && deferredWrites) {
+        if (!draining && !rdQueue.empty()) {
+            draining = true;
+            drainStartCycle = cmdCycle;
+            profDrains.inc();
+            if (inBurst) profBurstDrains.inc();
+        }
+        if (draining) profDrainWrites.inc();
+    } else if (draining) {
+        draining = false;
+        uint64_t drainSysCycles = (cmdCycle - drainStartCycle)*sysFreqKHz/memFreqKHz;
+        drainLatencyHist.inc(MIN(DRAIN_NUMBINS - 1, drainSysCycles/DRAIN_BINSIZE), 1);
+    }
     minRespCycle = cmdCycle + tCL + tBL;
     lastCmdWasWrite = r->write;
     bank.dirty |= r->write;
@@ -600,7 +662,16 @@ uint64_t DDRMemory::trySchedule(uint64_t curCycle, uint64_t sysCycle) {
     // Record PRE
     // if closed-page, close (auto-precharge) if no more row buffer hits
     // if open-page, minPreCycle is used for row buffer misses
-    if (closedPage && !(r->next && r->next->rowHitSeq != 0)) { bank.open = false; }
+    InList<Request>& bankQueue = isWriteQueue? bank.wrReqs : bank.rdReqs;
+    bool moreRowHits;
+    if (arrivalOrdered) {
+        moreRowHits = r->next && r->next->rowHitSeq != 0;
+    } else {
+        moreRowHits = false;
+        for (Request* o = bankQueue.front(); o && !moreRowHits; o = o->next) moreRowHits = (o != r && o->loc.row == r->loc.row);
+        r->rowHitSeq = rowHit? bank.curRowHits + 1 : 0;
+    }
+    if (closedPage && !moreRowHits) { bank.open = false; }
     bank.minPreCycle = std::max(
             bank.minPreCycle,  // for mixed read and write commands, minPreCycle may not be monotonic without this
             std::max(bank.lastActCycle + tRAS,  // RAS constraint
@@ -611,6 +682,7 @@ uint64_t DDRMemory::trySchedule(uint64_t curCycle, uint64_t sysCycle) {
     assert(bank.lastCmdCycle < cmdCycle);
     bank.lastCmdCycle = cmdCycle;
     bank.curRowHits = r->rowHitSeq;
+    sched->issue(r->si, r->write, cmdCycle);
 
     // Issue response
     if (r->ev) {
@@ -639,10 +711,80 @@ uint64_t DDRMemory::trySchedule(uint64_t curCycle, uint64_t sysCycle) {
     DEBUG("Served 0x%lx lat %ld clocks", r->addr, minRespCycle-curCycle);
 
     // Dequeue this req
-    queue.remove(ir);
-    (isWriteQueue? bank.wrReqs : bank.rdReqs).pop_front();
+    AddrLoc loc = r->loc;
+    if (arrivalOrdered) bankQueue.pop_front();
+    else bankQueue.remove(r);
+    queue.remove(r);
 
-    return (rdQueue.empty() && wrQueue.empty())? -1ul : minRespCycle - tCL;
+    if (rdQueue.empty() && wrQueue.empty()) return -1ul;
+    if (!arrivalOrdered) return minRespCycle - tCL;
+
+    // The bank's state changed, so its heads' ready cycles may have moved either way. Other
+    // banks' keys can only have grown (e.g., through the rank's ACT window), so they stay
+    // valid lower bounds. Wake up when some head may be ready, not just when the bus frees
+    // up, to avoid ticks that find nothing to issue.
+    updateReady(loc.rank, loc.bank);
+    return std::max(minRespCycle - tCL, std::min(rdReady.topKey(), wrReady.topKey()));
+}
+
+// FR-FCFS: bank queues are ordered at arrival, so we pick the oldest ready bank head. With
+// batchWrites, draining writes picks the oldest ready head that hits in its open row first,
+// batching writes by row. Only banks whose ready key has passed are examined, and their keys are
+// refreshed on the way.
+DDRMemory::Request* DDRMemory::selectReadyHead(bool writes, uint64_t curCycle, uint64_t& minSchedCycle) {
+    BankReadyHeap& ready = writes? wrReady : rdReady;
+    uint32_t n = 0;
+    auto collect = [&](uint32_t b) { readyBanks[n++] = b; };
+    ready.forEachReady(curCycle, collect);
+
+    Request* r = nullptr;
+    bool rHit = false;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t b = readyBanks[i];
+        const Bank& bank = banks[b / banksPerRank][b % banksPerRank];
+        Request* h = (writes? bank.wrReqs : bank.rdReqs).front();
+        assert(h && !h->prev);
+        uint64_t minCmdCycle = findMinCmdCycle(*h);
+        ready.update(b, minCmdCycle);
+        if (minCmdCycle > curCycle) continue;
+
+        bool hit = writes && batchWrites && bank.open && bank.openRow == h->loc.row;
+        if (!r || (hit && !rHit) || (hit == rHit && h->si.seq < r->si.seq)) {
+            r = h;
+            rHit = hit;
+        }
+    }
+    if (!r) minSchedCycle = ready.topKey();
+    return r;
+}
+
+// Picks the request the scheduling policy prefers among all the ready ones. Unlike FR-FCFS, which
+// orders bank queues at arrival, this decides with the bank state at issue time, as a real
+// scheduler would; it only sees requests that have already arrived, so it's not oracular.
+DDRMemory::Request* DDRMemory::selectRequest(RequestQueue<Request>& queue, uint64_t curCycle, uint64_t& minSchedCycle) {
+    sched->beginSelection(curCycle);
+    if (sched->needsBatch()) {
+        for (auto it = rdQueue.begin(); it != rdQueue.end(); it.inc()) sched->mark((*it)->si);
+        sched->endBatch();
+    }
+
+    Request* best = nullptr;
+    bool bestHit = false;
+    for (auto it = queue.begin(); it != queue.end(); it.inc()) {
+        Request* c = *it;
+        uint64_t minCmdCycle = findMinCmdCycle(*c);
+        minSchedCycle = std::min(minSchedCycle, minCmdCycle);
+        if (minCmdCycle > curCycle) continue;
+
+        const Bank& bank = banks[c->loc.rank][c->loc.bank];
+        // As with FR-FCFS, batchWrites lifts the hit cap for writes
+        bool hit = bank.open && c->loc.row == bank.openRow && ((batchWrites && c->write) || sched->prioritizeHit(bank.curRowHits));
+        if (!best || sched->before(c->si, hit, best->si, bestHit)) {
+            best = c;
+            bestHit = hit;
+        }
+    }
+    return best;
 }
 
 void DDRMemory::refresh(uint64_t sysCycle) {
@@ -667,6 +809,11 @@ void DDRMemory::refresh(uint64_t sysCycle) {
             bank.dirty = false;
         }
     }
+    if (arrivalOrdered) {
+        for (uint32_t r = 0; r < ranksPerChannel; r++) {
+            for (uint32_t b = 0; b < banksPerRank; b++) updateReady(r, b);
+        }
+    }
 
     DEBUG("Refresh %ld start %ld done %ld", memCycle, minRefreshCycle, refreshDoneCycle);
 }
@@ -27,9 +27,12 @@
 #define DDR_MEM_H_
 
 #include <deque>
+#include <utility>
 
+#include "addr_mapping.h"
 #include "g_std/g_string.h"
 #include "intrusive_list.h"
+#include "mem_sched.h"
 //#include "memory_hierarchy.h"
 #include "phase_concurrent_memory_hierarchy.h"
 #include "pad.h"
@@ -88,11 +91,12 @@ class RequestQueue {
         };
         InList<Node> reqList;  // FIFO
         InList<Node> freeList; // LIFO (higher locality)
+        Node* buf;
 
     public:
         void init(size_t size) {
             assert(reqList.empty() && freeList.empty());
-            Node* buf = gm_calloc<Node>(size);
+            buf = gm_calloc<Node>(size);
             for (uint32_t i = 0; i < size; i++) {
                 new (&buf[i]) Node();
                 freeList.push_back(&buf[i]);
@@ -128,6 +132,83 @@ class RequestQueue {
             reqList.remove(i.n);
             freeList.push_back(i.n);
         }
+
+        // Elements live in a single array of nodes, so we can find an element's node without walking the list
+        inline void remove(T* e) {
+            size_t idx = (reinterpret_cast<char*>(e) - reinterpret_cast<char*>(&buf[0].elem))/sizeof(Node);
+            assert(&buf[idx].elem == e);
+            remove(iterator(&buf[idx]));
+        }
+};
+
+/* Indexed min-heap of banks, keyed by the cycle the head of each bank's queue
+ * can issue (-1 if the queue is empty). Keys may be lower bounds (e.g., an ACT
+ * in another bank of the rank can only delay a head), so the scheduler only
+ * needs to revisit banks whose key has passed.
+ */
+class BankReadyHeap {
+    private:
+        g_vector<uint64_t> key;  // indexed by bank
+        g_vector<uint32_t> heap;  // bank ids
+        g_vector<uint32_t> pos;  // bank -> heap position
+
+    public:
+        void init(uint32_t numBanks) {
+            key.resize(numBanks);
+            heap.resize(numBanks);
+            pos.resize(numBanks);
+            for (uint32_t b = 0; b < numBanks; b++) {
+                key[b] = -1ul;
+                heap[b] = pos[b] = b;
+            }
+        }
+
+        inline uint64_t topKey() const { return key[heap[0]]; }
+
+        void update(uint32_t b, uint64_t k) {
+            uint64_t old = key[b];
+            key[b] = k;
+            if (k < old) siftUp(pos[b]);
+            else if (k > old) siftDown(pos[b]);
+        }
+
+        // Calls f(bank) on all banks with key <= cycle. f must not update the heap.
+        template <typename F>
+        inline void forEachReady(uint64_t cycle, F& f) const { visit(0, cycle, f); }
+
+    private:
+        template <typename F>
+        void visit(uint32_t i, uint64_t cycle, F& f) const {
+            if (i >= heap.size() || key[heap[i]] > cycle) return;
+            f(heap[i]);
+            visit(2*i + 1, cycle, f);
+            visit(2*i + 2, cycle, f);
+        }
+
+        inline void swap(uint32_t i, uint32_t j) {
+            std::swap(heap[i], heap[j]);
+            pos[heap[i]] = i;
+            pos[heap[j]] = j;
+        }
+
+        void siftUp(uint32_t i) {
+            while (i && key[heap[(i - 1)/2]] > key[heap[i]]) {
+                swap(i, (i - 1)/2);
+                i = (i - 1)/2;
+            }
+        }
+
+        void siftDown(uint32_t i) {
+            while (true) {
+                uint32_t m = i;
+                uint32_t l = 2*i + 1, r = 2*i + 2;
+                if (l < heap.size() && key[heap[l]] < key[heap[m]]) m = l;
+                if (r < heap.size() && key[heap[r]] < key[heap[m]]) m = r;
+                if (m == i) return;
+                swap(i, m);
+                i = m;
+            }
+        }
 };
 
 class DDRMemoryAccEvent;
@@ -137,12 +218,7 @@ class SchedEvent;
 class DDRMemory : public MemObject {
     private:
 
-        struct AddrLoc {
-            uint64_t row;
-            uint32_t bank;
-            uint32_t rank;
-            uint32_t col;
-        };
+        typedef DRAMAddrLoc AddrLoc;
 
         struct Request : InListNode<Request> {
             Address addr;
@@ -150,6 +226,7 @@ class DDRMemory : public MemObject {
             bool write;
 
             uint64_t rowHitSeq; // sequence number used to throttle max # row hits
+            MemSchedInfo si;
 
             // Cycle accounting
             uint64_t arrivalCycle;  // in memCycles
@@ -194,12 +271,19 @@ class DDRMemory : public MemObject {
         const uint32_t lineSize, ranksPerChannel, banksPerRank;
         const uint32_t controllerSysLatency;  // in sysCycles
         const uint32_t queueDepth;
+        const uint32_t wrQueueDepth;
         const uint32_t rowHitLimit; // row hits not prioritized in FR-FCFS beyond this point
         const bool deferredWrites;
+        const bool batchWrites; // deferred writes are batched by row past rowHitLimit
         const bool closedPage;
         const bool isNVM;
         const uint32_t domain;
 
+        // Scheduling policy. FR-FCFS orders bank queues at arrival and takes the first ready bank
+        // head; other policies keep bank queues in arrival order and pick among all ready requests.
+        MemSchedPolicy* sched;
+        bool arrivalOrdered;
+
         // DRAM timing parameters -- initialized in initTech()
         // All parameters are in memory clocks (multiples of tCK)
         uint32_t tBL;    // burst length (== tTrans)
@@ -216,21 +300,48 @@ class DDRMemory : public MemObject {
         uint32_t tREFI;  // Refresh interval
 
         // Address mapping information
-        uint32_t colShift, colMask;
-        uint32_t rankShift, rankMask;
-        uint32_t bankShift, bankMask;
-        uint64_t rowShift;  // row's always top
+        DRAMAddrMapping addrMap;
 
         uint32_t minRdLatency;
         uint32_t minWrLatency;
         uint32_t preDelay, postDelayRd, postDelayWr;
 
         RequestQueue<Request> rdQueue, wrQueue;
-        std::deque<Request> overflowQueue;
+        // Requests that found their queue full. Kept per queue so that reads are never stuck
+        // behind writes waiting for a write queue slot (or vice versa).
+        std::deque<Request> rdOverflowQueue, wrOverflowQueue;
+
+        /* Write drain control. Writes are acknowledged on arrival and drained in batches to
+         * amortize bus turnarounds. Normally, a drain starts above the high watermark (3/4 of
+         * the write queue) and, once started, continues down to the low watermark (1/4). When
+         * writes arrive in a burst (e.g., all cores writing back their dirty lines at a
+         * barrier), waiting for the high watermark lets the queue overflow and stalls reads
+         * for the whole burst, so drains start earlier, at half occupancy.
+         *
+         * A burst is detected from the write arrival rate: if, within a window of
+         * BURST_WINDOW bus transfers, more writes arrive than burstThreshold (a fraction of
+         * what the bus could drain in that time), we're in a burst until a window ends
+         * below the threshold.
+         */
+        static const uint32_t BURST_WINDOW = 32;  // in bursts (tBL)
+        uint32_t burstWindow;  // in memCycles
+        uint32_t burstThreshold;  // writes per window, 0 disables burst detection
+        uint64_t burstWindowEnd;
+        uint32_t windowWrites;
+        bool inBurst;
+
+        // Drain episodes, i.e., runs of writes issued while reads were waiting
+        bool draining;
+        uint64_t drainStartCycle;  // in memCycles
 
         g_vector< g_vector<Bank> > banks; // indexed by rank, bank
         g_vector<ActWindow> rankActWindows;
 
+        // FR-FCFS only: when each bank's read and write queue heads can issue. A tick only
+        // looks at banks that may be ready, instead of all queued requests.
+        BankReadyHeap rdReady, wrReady;
+        g_vector<uint32_t> readyBanks;  // scratch
+
         // Event scheduling
         SchedEvent* nextSchedEvent;
         uint64_t nextSchedCycle;
@@ -246,6 +357,11 @@ class DDRMemory : public MemObject {
         Counter profRowBufCloses, profExpRowBufCloses;
         VectorCounter latencyHist;
         static const uint32_t BINSIZE = 10, NUMBINS = 100;
+        Counter profRdOverflows, profWrOverflows;
+        Counter profWrBursts, profDrains, profBurstDrains, profDrainWrites;
+        VectorCounter wrOccupancyHist;  // write queue occupancy seen by arriving writes, in 1/OCC_BINS of wrQueueDepth
+        VectorCounter drainLatencyHist;  // sysCycles reads wait for each drain
+        static const uint32_t OCC_BINS = 16, DRAIN_BINSIZE = 50, DRAIN_NUMBINS = 64;
         PAD();
 
         //In KHz, though it does not matter so long as they are consistent and fine-grain enough (not Hz because we multiply
@@ -266,12 +382,13 @@ class DDRMemory : public MemObject {
 
     public:
         DDRMemory(uint32_t _lineSize, uint32_t _colSize, uint32_t _ranksPerChannel, uint32_t _banksPerRank,
-            uint32_t _sysFreqMHz, const char* tech, const char* addrMapping, uint32_t _controllerSysLatency,
-            uint32_t _queueDepth, uint32_t _rowHitLimit, bool _deferredWrites, bool _closedPage, bool _isNVM,
-            uint32_t _domain, g_string& _name);
+            uint32_t _sysFreqMHz, const char* tech, const char* addrMapping, const char* bankHash, uint32_t _controllerSysLatency,
+            uint32_t _queueDepth, uint32_t _wrQueueDepth, uint32_t _rowHitLimit, bool _deferredWrites, bool _batchWrites,
+            bool _closedPage, bool _isNVM, const char* schedPolicy, uint32_t _wrBurstRate, uint32_t _domain, g_string& _name);
 
         void initStats(AggregateStat* parentStat);
         const char* getName() {return name.c_str();}
+        uint32_t getLoad(Address lineAddr);
 
         // Bound phase interface
         uint64_t access(MemReq& req);
@@ -288,9 +405,14 @@ class DDRMemory : public MemObject {
         AddrLoc mapLineAddr(Address lineAddr);
 
         void queue(Request* req, uint64_t memCycle);
+        uint64_t dequeueOverflow(std::deque<Request>& ovfQueue, RequestQueue<Request>& q, uint64_t memCycle, uint64_t minSchedCycle);
+        void updateWriteBurst(uint64_t memCycle);
 
         inline uint64_t trySchedule(uint64_t curCycle, uint64_t sysCycle);
         uint64_t findMinCmdCycle(const Request& r) const;
+        Request* selectReadyHead(bool writes, uint64_t curCycle, uint64_t& minSchedCycle);
+        Request* selectRequest(RequestQueue<Request>& queue, uint64_t curCycle, uint64_t& minSchedCycle);
+        void updateReady(uint32_t rank, uint32_t bank);
 
         void initTech(const char* tech);
 };
@@ -27,6 +27,7 @@
 #include "zsim.h"
 #include "tick_event.h"
 #include <algorithm>
+#include <sstream>
 
 MemRankBase::MemRankBase(uint32_t _myId, uint32_t _parentId, uint32_t _bankCount) {
     myId = _myId;
@@ -135,6 +136,11 @@ bool MemChannelBase::IsRowBufferHit(uint32_t row, uint32_t rank, uint32_t bank)
     return ((ranks[rank]->GetBankOpen(bank) == true) && (ranks[rank]->GetLastRow(bank) == row));
 }
 
+bool MemChannelBase::GetOpenRow(uint32_t rank, uint32_t bank, uint32_t& row) {
+    row = ranks[rank]->GetLastRow(bank);
+    return ranks[rank]->GetBankOpen(bank);
+}
+
 
 uint32_t MemChannelBase::UpdateRefreshNum(uint32_t rank, uint64_t arrivalCycle) {
     //////////////////////////////////////////////////////////////////////
@@ -840,57 +846,180 @@ uint64_t MemChannelBase::GetBackGroundEnergy(uint64_t memCycle, uint64_t lastMem
 }
 
 
+////////////////////////////////////////////////////////////////////////
+// Scheduler Queue Class
+void MemSchedQueue::init(uint32_t rankCount, uint32_t _bankCount) {
+    assert(empty());
+    bankCount = _bankCount;
+    Bucket empty = {NIL, NIL};
+    buckets.assign(rankCount * bankCount, empty);
+}
+
+void MemSchedQueue::push(MemAccessEventBase* ev, Address addr, uint32_t row, uint32_t rank, uint32_t bank, const MemSchedInfo& si) {
+    uint32_t idx = freeHead;
+    if (idx == NIL) {
+        idx = pool.size();
+        pool.push_back(Elem());
+    } else {
+        freeHead = pool[idx].next;
+    }
+
+    Elem& e = pool[idx];
+    e.ev = ev;
+    e.addr = addr;
+    e.seq = nextSeq++;
+    e.row = row;
+    e.rank = rank;
+    e.bank = bank;
+    e.si = si;
+
+    e.prev = tail;
+    e.next = NIL;
+    if (tail != NIL) pool[tail].next = idx;
+    else head = idx;
+    tail = idx;
+
+    Bucket& b = buckets[rank * bankCount + bank];
+    e.bankPrev = b.tail;
+    e.bankNext = NIL;
+    if (b.tail != NIL) pool[b.tail].bankNext = idx;
+    else b.head = idx;
+    b.tail = idx;
+
+    elems++;
+}
+
+void MemSchedQueue::remove(uint32_t idx) {
+    assert(idx < pool.size());
+    Elem& e = pool[idx];
+
+    if (e.prev != NIL) pool[e.prev].next = e.next;
+    else head = e.next;
+    if (e.next != NIL) pool[e.next].prev = e.prev;
+    else tail = e.prev;
+
+    Bucket& b = buckets[e.rank * bankCount + e.bank];
+    if (e.bankPrev != NIL) pool[e.bankPrev].bankNext = e.bankNext;
+    else b.head = e.bankNext;
+    if (e.bankNext != NIL) pool[e.bankNext].bankPrev = e.bankPrev;
+    else b.tail = e.bankPrev;
+
+    e.next = freeHead;
+    freeHead = idx;
+    elems--;
+}
+
+void MemSchedQueue::moveTo(uint32_t idx, MemSchedQueue& dst) {
+    Elem e = pool[idx];
+    remove(idx);
+    dst.push(e.ev, e.addr, e.row, e.rank, e.bank, e.si);
+}
+
+bool MemSchedQueue::isRowHit(uint32_t idx, MemChannelBase* chnl) const {
+    const Elem& e = pool[idx];
+    return chnl->IsRowBufferHit(e.row, e.rank, e.bank);
+}
+
+void MemSchedQueue::markAll(MemSchedPolicy* policy) {
+    for (uint32_t idx = head; idx != NIL; idx = pool[idx].next) policy->mark(pool[idx].si);
+}
+
+uint32_t MemSchedQueue::find(Address addr, uint32_t rank, uint32_t bank) const {
+    uint32_t idx = buckets[rank * bankCount + bank].head;
+    while (idx != NIL && pool[idx].addr != addr) idx = pool[idx].bankNext;
+    return idx;
+}
+
+uint32_t MemSchedQueue::findBest(MemChannelBase* chnl, const MemSchedPolicy* policy, const g_vector<uint32_t>& bankRowHits) const {
+    uint32_t best = NIL;
+    if (policy->isFRFCFS()) {
+        for (uint32_t b = 0; b < buckets.size(); b++) {
+            uint32_t idx = buckets[b].head;
+            uint32_t openRow;
+            if (idx == NIL || !policy->prioritizeHit(bankRowHits[b]) || !chnl->GetOpenRow(b / bankCount, b % bankCount, openRow)) continue;
+            // Bank lists are in age order, so the first hit is this bank's oldest
+            while (idx != NIL && pool[idx].row != openRow) idx = pool[idx].bankNext;
+            if (idx != NIL && (best == NIL || pool[idx].seq < pool[best].seq)) best = idx;
+        }
+        return (best != NIL)? best : head;
+    }
+
+    bool bestHit = false;
+    for (uint32_t idx = head; idx != NIL; idx = pool[idx].next) {
+        const Elem& e = pool[idx];
+        uint32_t b = e.rank * bankCount + e.bank;
+        uint32_t openRow;
+        bool hit = policy->prioritizeHit(bankRowHits[b]) && chnl->GetOpenRow(e.rank, e.bank, openRow) && openRow == e.row;
+        if (best == NIL || policy->before(e.si, hit, pool[best].si, bestHit)) {
+            best = idx;
+            bestHit = hit;
+        }
+    }
+    return best;
+}
+
+
 ////////////////////////////////////////////////////////////////////////
 // Default Memory Scheduler Class
-MemSchedulerDefault::MemSchedulerDefault(uint32_t id, MemParam* mParam, MemChannelBase* mChnl)
-    : MemSchedulerBase(id, mParam, mChnl)
+void MemSchedulerBase::initStats(AggregateStat* parentStat) {
+    std::stringstream ss;
+    ss << "sched-" << id;
+    policy->initStats(parentStat, gm_strdup(ss.str().c_str()));
+}
+
+MemSchedulerDefault::MemSchedulerDefault(uint32_t id, MemParam* mParam, MemChannelBase* mChnl, MemSchedPolicy* policy)
+    : MemSchedulerBase(id, mParam, mChnl, policy)
 {
     prioritizedAccessType = READ;
     wrQueueSize = mParam->schedulerQueueCount;
     wrQueueHighWatermark = mParam->schedulerQueueCount * 2 / 3;
     wrQueueLowWatermark = mParam->schedulerQueueCount * 1 / 3;
+    rdQueue.init(mParam->rankCount, mParam->bankCount);
+    wrQueue.init(mParam->rankCount, mParam->bankCount);
+    wrDoneQueue.init(mParam->rankCount, mParam->bankCount);
+    bankRowHits.resize(mParam->rankCount * mParam->bankCount, 0);
 }
 
 MemSchedulerDefault::~MemSchedulerDefault() {}
 
-bool MemSchedulerDefault::CheckSetEvent(MemAccessEventBase* ev) {
+bool MemSchedulerDefault::CheckSetEvent(MemAccessEventBase* ev, uint64_t memCycle) {
+    Address addr = ev->getAddr();
+    uint32_t row, col, rank, bank;
+    mChnl->AddressMap(addr, row, col, rank, bank);
+
     // Write Queue Hit Check
-    g_vector<MemSchedQueueElem>::iterator it;
-    for(it = wrQueue.begin(); it != wrQueue.end(); it++) {
-        if (it->second == ev->getAddr()) {
-            if (ev->getType() == WRITE) {
-                wrQueue.erase(it);
-                wrQueue.push_back(MemSchedQueueElem(nullptr, ev->getAddr()));
-            }
-            return true;
-        }
+    uint32_t idx = wrQueue.find(addr, rank, bank);
+    if (idx != MemSchedQueue::NIL) {
+        if (ev->getType() == WRITE) wrQueue.moveTo(idx, wrQueue);
+        return true;
     }
 
     // Write Done Queue Hit Check
-    for(it = wrDoneQueue.begin(); it != wrDoneQueue.end(); it++) {
-        if (it->second == ev->getAddr()) {
-            if (ev->getType() == READ) {
-                // Update LRU
-                wrDoneQueue.erase(it);
-                wrDoneQueue.push_back(MemSchedQueueElem(nullptr, ev->getAddr()));
-            } else { // Write
-                // Update for New Data
-                wrDoneQueue.erase(it);
-                wrQueue.push_back(MemSchedQueueElem(nullptr, ev->getAddr()));
-            }
-            return true;
+    idx = wrDoneQueue.find(addr, rank, bank);
+    if (idx != MemSchedQueue::NIL) {
+        if (ev->getType() == READ) {
+            // Update LRU
+            wrDoneQueue.moveTo(idx, wrDoneQueue);
+        } else { // Write
+            // Update for New Data
+            wrDoneQueue.moveTo(idx, wrQueue);
         }
+        return true;
     }
 
     // No Hit
+    MemSchedInfo si;
+    si.srcId = ev->getSrcId();
+    si.bank = rank * mParam->bankCount + bank;
+    policy->arrive(si, memCycle);
     if (ev->getType() == READ) {
-        rdQueue.push_back(MemSchedQueueElem(ev, ev->getAddr()));
+        rdQueue.push(ev, addr, row, rank, bank, si);
     } else { // Write
-        wrQueue.push_back(MemSchedQueueElem(nullptr, ev->getAddr()));
+        wrQueue.push(nullptr, addr, row, rank, bank, si);
         if (wrQueue.size() + wrDoneQueue.size() == wrQueueSize) {
             // Overflow case
             if (wrDoneQueue.empty() == false) {
-                wrDoneQueue.erase(wrDoneQueue.begin());
+                wrDoneQueue.remove(wrDoneQueue.oldest());
             } else {
                 // FIXME: Need to handle this - HK
                 warn("Write Buffer Overflow!!");
@@ -900,9 +1029,13 @@ bool MemSchedulerDefault::CheckSetEvent(MemAccessEventBase* ev) {
     return false;
 }
 
-bool MemSchedulerDefault::GetEvent(MemAccessEventBase*& ev, Address& addr, MemAccessType& type) {
-    bool bRet = false;
+void MemSchedulerDefault::Issue(MemSchedQueue& queue, uint32_t idx, bool write, uint64_t memCycle) {
+    uint32_t b = queue.getBank(idx);
+    bankRowHits[b] = queue.isRowHit(idx, mChnl)? bankRowHits[b] + 1 : 0;
+    policy->issue(queue.getInfo(idx), write, memCycle);
+}
 
+bool MemSchedulerDefault::GetEvent(MemAccessEventBase*& ev, Address& addr, MemAccessType& type, uint64_t memCycle) {
     // Check Priority
     if (wrQueue.size() >= wrQueueHighWatermark)
         prioritizedAccessType = WRITE; // Write Priority
@@ -912,55 +1045,42 @@ bool MemSchedulerDefault::GetEvent(MemAccessEventBase*& ev, Address& addr, MemAc
     //info("Id%d: Read Queue = %ld, Write Queue = %ld, Schedule = %d",
     //myId, rdQueue.size(), wrQueue.size(), prioritizedAccessType);
 
-    uint32_t idx;
-    g_vector<MemSchedQueueElem>::iterator it;
+    policy->beginSelection(memCycle);
+    if (policy->needsBatch()) {
+        rdQueue.markAll(policy);
+        policy->endBatch();
+    }
+
     if (prioritizedAccessType == READ) {
-        bRet = FindBestRequest(&rdQueue, idx);
-        if (bRet) {
-            it = rdQueue.begin() + idx;
-            ev = it->first;
+        uint32_t idx = rdQueue.findBest(mChnl, policy, bankRowHits);
+        if (idx != MemSchedQueue::NIL) {
+            ev = rdQueue.getEvent(idx);
             addr = ev->getAddr();
             type = ev->getType();
-            rdQueue.erase(it);
-        }
-    }
-
-    if (!bRet) { // Write Priority or No Read Entry
-        bRet = FindBestRequest(&wrQueue, idx);
-        if (bRet) {
-            it = wrQueue.begin() + idx;
-            ev = nullptr;
-            addr = it->second;
-            type = WRITE;
-            wrQueue.erase(it);
-            wrDoneQueue.push_back(MemSchedQueueElem(nullptr, addr));
+            Issue(rdQueue, idx, false, memCycle);
+            rdQueue.remove(idx);
+            return true;
         }
     }
 
-    return bRet;
-}
-
-bool MemSchedulerDefault::FindBestRequest(g_vector<MemSchedQueueElem> *queue, uint32_t& idx) {
-    idx = 0;
-    uint32_t tmpIdx = 0;
-    g_vector<MemSchedQueueElem>::iterator it;
-    for(it = queue->begin(); it!= queue->end(); it++) {
-        Address addr = it->second;
-        uint32_t row, col, rank, bank;
-        mChnl->AddressMap(addr, row, col, rank, bank);
-        if (mChnl->IsRowBufferHit(row, rank, bank) == true) {
-            idx = tmpIdx;
-            break;
-        }
-        tmpIdx++;
+    // Write Priority or No Read Entry
+    uint32_t idx = wrQueue.findBest(mChnl, policy, bankRowHits);
+    if (idx != MemSchedQueue::NIL) {
+        ev = nullptr;
+        addr = wrQueue.getAddr(idx);
+        type = WRITE;
+        Issue(wrQueue, idx, true, memCycle);
+        wrQueue.moveTo(idx, wrDoneQueue);
+        return true;
     }
 
-    return !queue->empty();
+    return false;
 }
 
 
 // Main Memory Class
-MemControllerBase::MemControllerBase(g_string _memCfg, uint32_t _cacheLineSize, uint32_t _sysFreqMHz, uint32_t _domain, g_string& _name) {
+MemControllerBase::MemControllerBase(g_string _memCfg, uint32_t _cacheLineSize, uint32_t _sysFreqMHz, const char* schedPolicy, uint32_t rowHitCap,
+        uint32_t _domain, g_string& _name) {
     name = _name;
     domain = _domain;
     info("%s: domain %d", name.c_str(), domain);
@@ -1017,7 +1137,9 @@ MemControllerBase::MemControllerBase(g_string _memCfg, uint32_t _cacheLineSize,
     sches.resize(mParam->channelCount);
     for(uint32_t i = 0; i < mParam->channelCount; i++) {
         chnls[i] = new MemChannelBase (i, mParam);
-        sches[i] = new MemSchedulerDefault(i, mParam, chnls[i]);
+        MemSchedPolicy* policy = CreateMemSchedPolicy(schedPolicy, MAX(zinfo->numCores, 1u), mParam->rankCount * mParam->bankCount,
+                rowHitCap, mParam->GetDataLatency(0));
+        sches[i] = new MemSchedulerDefault(i, mParam, chnls[i], policy);
     }
 
     if (mParam->schedulerQueueCount != 0) {
@@ -1058,7 +1180,7 @@ void MemControllerBase::enqueue(MemAccessEventBase* ev, uint64_t cycle) {
 
     // Write Queue Hit Check
     uint32_t channel = ReturnChannel(ev->getAddr());
-    bool bRet = sches[channel]->CheckSetEvent(ev);
+    bool bRet = sches[channel]->CheckSetEvent(ev, sysToMemCycle(cycle));
     if (ev->getType() == READ) {
         if (bRet)
             ev->done(cycle - minLatency[0] + mParam->controllerLatency);
@@ -1087,7 +1209,7 @@ void MemControllerBase::TickScheduler(uint64_t sysCycle) {
         MemAccessEventBase* ev = nullptr;
         Address  addr = 0;
         MemAccessType type = READ;
-        bool bRet = sches[i]->GetEvent(ev, addr, type);
+        bool bRet = sches[i]->GetEvent(ev, addr, type, sysToMemCycle(sysCycle));
         if (bRet) {
             uint64_t latency = LatencySimulate(addr, sysCycle, type);
             if (type == READ) {
@@ -1126,7 +1248,7 @@ uint64_t MemControllerBase::access(MemReq& req) {
         Address addr = req.lineAddr;
         MemAccessEventBase* memEv =
             new (zinfo->eventRecorders[req.srcId])
-            MemAccessEventBase(this, accessType, addr, domain, preDelay[accessType], postDelay[accessType]);
+            MemAccessEventBase(this, accessType, addr, req.srcId, domain, preDelay[accessType], postDelay[accessType]);
         memEv->setMinStartCycle(req.cycle);
         TimingRecord tr = {addr, req.cycle, respCycle, req.type, memEv, memEv};
         zinfo->eventRecorders[req.srcId]->pushRecord(tr);
@@ -1149,6 +1271,10 @@ void MemControllerBase::initStats(AggregateStat* parentStat) {
     profRefresh.init("ref", "Refresh command Times");
     memStats->append(&profRefresh);
 
+    if (mParam->schedulerQueueCount != 0) {
+        for (MemSchedulerBase* sche : sches) sche->initStats(memStats);
+    }
+
     if (mParam->accAvgPowerReport == true) {
         AggregateStat* apStats = new AggregateStat();
         apStats->init("ap", "Cumulative Average Power Report");
@@ -28,6 +28,7 @@
 
 #include "detailed_mem_params.h"
 #include "g_std/g_string.h"
+#include "mem_sched.h"
 //#include "memory_hierarchy.h"
 #include "phase_concurrent_memory_hierarchy.h"
 #include "stats.h"
@@ -169,6 +170,7 @@ class MemChannelBase : public GlobAlloc {
         virtual uint64_t LatencySimulate(Address lineAddr, uint64_t arrivalCycle, uint64_t lastPhaseCycle, MemAccessType type);
         virtual void AddressMap(Address addr, uint32_t& row, uint32_t& col, uint32_t& rank, uint32_t& bank);
         bool IsRowBufferHit(uint32_t row, uint32_t rank, uint32_t bank);
+        bool GetOpenRow(uint32_t rank, uint32_t bank, uint32_t& row);
 
         virtual uint64_t GetActivateCount(void);
         virtual uint64_t GetPrechargeCount(void);
@@ -194,15 +196,19 @@ class MemSchedulerBase : public GlobAlloc {
         uint32_t id;
         MemParam* mParam;
         MemChannelBase* mChnl;
+        MemSchedPolicy* policy;
 
     public:
 
-        MemSchedulerBase(uint32_t id, MemParam* mParam, MemChannelBase* mChnl)
-            : id(id), mParam(mParam), mChnl(mChnl) {}
+        MemSchedulerBase(uint32_t id, MemParam* mParam, MemChannelBase* mChnl, MemSchedPolicy* policy)
+            : id(id), mParam(mParam), mChnl(mChnl), policy(policy) {}
 
-        virtual ~MemSchedulerBase() {}
+        virtual ~MemSchedulerBase() { delete policy; }
 
-        virtual bool CheckSetEvent(MemAccessEventBase* ev) = 0;
+        virtual void initStats(AggregateStat* parentStat);
+
+        // memCycle is the current memory cycle
+        virtual bool CheckSetEvent(MemAccessEventBase* ev, uint64_t memCycle) = 0;
 
         // HK: I hope there's a good reason to be using a reference to a pointer here
         // Don't know the code enough at the moment to be able to tell.
@@ -214,7 +220,60 @@ class MemSchedulerBase : public GlobAlloc {
         // know what yet). Will look into this further
         //
         // FIXME(dsm): refpointer? pointeref? Hmmm...
-        virtual bool GetEvent(MemAccessEventBase*& ev, Address& addr, MemAccessType& type) = 0;
+        virtual bool GetEvent(MemAccessEventBase*& ev, Address& addr, MemAccessType& type, uint64_t memCycle) = 0;
+};
+
+// Scheduler queue, bucketed by (rank, bank). Each element is linked both in age order and in its
+// bank's list, over a growable pool with index links, so removal is O(1). Elements cache their
+// decoded row, so FR-FCFS selection only walks the lists of banks with an open row. Other
+// scheduling policies walk the whole queue in age order.
+class MemSchedQueue {
+    public:
+        static const uint32_t NIL = (uint32_t)-1;
+
+    private:
+        struct Elem {
+            MemAccessEventBase* ev;
+            Address addr;
+            uint64_t seq;  // arrival order
+            uint32_t row, rank, bank;
+            MemSchedInfo si;
+            uint32_t prev, next;  // age list; next also links free elements
+            uint32_t bankPrev, bankNext;
+        };
+
+        struct Bucket {
+            uint32_t head, tail;
+        };
+
+        g_vector<Elem> pool;
+        g_vector<Bucket> buckets;  // indexed by rank*bankCount + bank
+        uint32_t bankCount;
+        uint32_t head, tail, freeHead;
+        uint32_t elems;
+        uint64_t nextSeq;
+
+    public:
+        MemSchedQueue() : bankCount(0), head(NIL), tail(NIL), freeHead(NIL), elems(0), nextSeq(0) {}
+        void init(uint32_t rankCount, uint32_t _bankCount);
+
+        uint32_t size() const { return elems; }
+        bool empty() const { return elems == 0; }
+        uint32_t oldest() const { return head; }
+        MemAccessEventBase* getEvent(uint32_t idx) const { return pool[idx].ev; }
+        Address getAddr(uint32_t idx) const { return pool[idx].addr; }
+        const MemSchedInfo& getInfo(uint32_t idx) const { return pool[idx].si; }
+        uint32_t getBank(uint32_t idx) const { return pool[idx].rank * bankCount + pool[idx].bank; }
+        bool isRowHit(uint32_t idx, MemChannelBase* chnl) const;
+
+        void push(MemAccessEventBase* ev, Address addr, uint32_t row, uint32_t rank, uint32_t bank, const MemSchedInfo& si);
+        void remove(uint32_t idx);
+        void moveTo(uint32_t idx, MemSchedQueue& dst);  // removes idx, pushes it as the youngest element of dst
+
+        uint32_t find(Address addr, uint32_t rank, uint32_t bank) const;  // only walks addr's bank, NIL if absent
+        void markAll(MemSchedPolicy* policy);  // offers every element to a new batch, oldest first
+        // The element the policy would issue first, NIL if empty. bankRowHits: consecutive row hits per bank
+        uint32_t findBest(MemChannelBase* chnl, const MemSchedPolicy* policy, const g_vector<uint32_t>& bankRowHits) const;
 };
 
 class MemSchedulerDefault : public MemSchedulerBase {
@@ -224,17 +283,18 @@ class MemSchedulerDefault : public MemSchedulerBase {
         uint32_t wrQueueHighWatermark;
         uint32_t wrQueueLowWatermark;
 
-        g_vector <MemSchedQueueElem> rdQueue;
-        g_vector <MemSchedQueueElem> wrQueue;
-        g_vector <MemSchedQueueElem> wrDoneQueue;
+        MemSchedQueue rdQueue;
+        MemSchedQueue wrQueue;
+        MemSchedQueue wrDoneQueue;
+        g_vector<uint32_t> bankRowHits;
 
-        bool FindBestRequest(g_vector <MemSchedQueueElem> *queue, uint32_t& idx);
+        void Issue(MemSchedQueue& queue, uint32_t idx, bool write, uint64_t memCycle);
 
     public:
-        MemSchedulerDefault(uint32_t id, MemParam* mParam, MemChannelBase* mChnl);
+        MemSchedulerDefault(uint32_t id, MemParam* mParam, MemChannelBase* mChnl, MemSchedPolicy* policy);
         ~MemSchedulerDefault();
-        bool CheckSetEvent(MemAccessEventBase* ev);
-        bool GetEvent(MemAccessEventBase*& ev, Address& addr, MemAccessType& type);
+        bool CheckSetEvent(MemAccessEventBase* ev, uint64_t memCycle);
+        bool GetEvent(MemAccessEventBase*& ev, Address& addr, MemAccessType& type, uint64_t memCycle);
 };
 
 // DRAM controller base class
@@ -318,7 +378,8 @@ class MemControllerBase : public MemObject {
 
 
     public:
-        MemControllerBase(g_string _memCfg, uint32_t _cacheLineSize, uint32_t _sysFreqMHz, uint32_t _domain, g_string& _name);
+        MemControllerBase(g_string _memCfg, uint32_t _cacheLineSize, uint32_t _sysFreqMHz, const char* schedPolicy, uint32_t rowHitCap,
+                uint32_t _domain, g_string& _name);
         virtual ~MemControllerBase();
 
         const char* getName() { return name.c_str(); }
@@ -336,14 +397,16 @@ class MemAccessEventBase : public TimingEvent {
         MemControllerBase* dram;
         MemAccessType type;
         Address addr;
+        uint32_t srcId;
 
     public:
-        MemAccessEventBase(MemControllerBase* _dram, MemAccessType _type, Address _addr, int32_t domain, uint32_t preDelay, uint32_t postDelay)
-            : TimingEvent(preDelay, postDelay, domain), dram(_dram), type(_type), addr(_addr) {}
+        MemAccessEventBase(MemControllerBase* _dram, MemAccessType _type, Address _addr, uint32_t _srcId, int32_t domain, uint32_t preDelay, uint32_t postDelay)
+            : TimingEvent(preDelay, postDelay, domain), dram(_dram), type(_type), addr(_addr), srcId(_srcId) {}
 
         void simulate(uint64_t startCycle) { dram->enqueue(this, startCycle); }
         MemAccessType getType() const { return type; }
         Address getAddr() const { return addr; }
+        uint32_t getSrcId() const { return srcId; }
 };
 
 #endif  // DETAILED_MEM_H_
@@ -28,6 +28,7 @@
 
 #include <map>
 #include <string>
+#include "addr_mapping.h"
 #include "g_std/g_string.h"
 //#include "memory_hierarchy.h"
 #include "phase_concurrent_memory_hierarchy.h"
@@ -82,18 +83,22 @@ class DRAMSimMemory : public MemObject { //one DRAMSim controller
 
 //DRAMSIM does not support non-pow2 channels, so:
 // - Encapsulate multiple DRAMSim controllers
-// - Fan out addresses interleaved across banks, and change the address to a "memory address"
+// - Fan out addresses interleaved (or hashed) across channels, and change the address to a "memory address"
 class SplitAddrMemory : public MemObject {
     private:
         const g_vector<MemObject*> mems;
+        ChannelMapping chMap;
         const g_string name;
     public:
-        SplitAddrMemory(const g_vector<MemObject*>& _mems, const char* _name) : mems(_mems), name(_name) {}
+        SplitAddrMemory(const g_vector<MemObject*>& _mems, const char* channelHash, const char* _name) : mems(_mems), name(_name) {
+            chMap.init(mems.size(), channelHash);
+            info("%s: %ld channels, %s channel hash", name.c_str(), mems.size(), chMap.hashName());
+        }
 
         uint64_t access(MemReq& req) {
             Address addr = req.lineAddr;
-            uint32_t mem = addr % mems.size();
-            Address ctrlAddr = addr/mems.size();
+            uint32_t mem = chMap.channel(addr);
+            Address ctrlAddr = chMap.ctrlAddr(addr);
             req.lineAddr = ctrlAddr;
             uint64_t respCycle = mems[mem]->access(req);
             req.lineAddr = addr;
@@ -104,6 +109,10 @@ class SplitAddrMemory : public MemObject {
             return name.c_str();
         }
 
+        uint32_t getLoad(Address lineAddr) {
+            return mems[chMap.channel(lineAddr)]->getLoad(chMap.ctrlAddr(lineAddr));
+        }
+
         void initStats(AggregateStat* parentStat) {
             for (auto mem : mems) mem->initStats(parentStat);
         }
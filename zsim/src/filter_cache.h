@@ -27,53 +27,118 @@
 #define FILTER_CACHE_H_
 
 #include "bithacks.h"
-#include "cache.h"
+#include "cache_impl.h"
 #include "galloc.h"
 #include "zsim.h"
 
-/* Extends Cache with an L0 direct-mapped cache, optimized to hell for hits
+/* Extends Cache with an L0 filter, optimized to hell for hits
  *
  * L1 lookups are dominated by several kinds of overhead (grab the cache locks,
  * several virtual functions for the replacement policy, etc.). This
  * specialization of Cache solves these issues by having a filter array that
- * holds the most recently used line in each set. Accesses check the filter array,
- * and then go through the normal access path. Because there is one line per set,
- * it is fine to do this without grabbing a lock.
+ * holds the most recently filled lines of each set (filterWays of them, 1-4).
+ * Accesses check the filter array, and then go through the normal access path.
+ * Misses go through the devirtualized access path of the only L1 configuration
+ * we support (see BuildCacheBank), or through a miss path cache, e.g., a
+ * TimingCache to model MSHRs and tag latency with weave-phase events, or a
+ * TracingCache. The miss path shares our cc, array and replacement policy, so
+ * it is just a different way to access the same cache: the rest of the system
+ * only sees (and invalidates) the FilterCache.
+ *
+ * Only fills, invalidations and flushes modify the filter, and they do so under
+ * filterLock. Hits don't lock: each set has a seqlock-style version, which writers
+ * make odd while they modify the set. A hit is only taken if the version was even
+ * and did not change while the set was read; otherwise, the access takes the slow
+ * path, which is always correct. Hits don't reorder the set, so entries are kept
+ * in fill order: entry 0 is the last line filled, the rest act as a victim buffer.
+ *
+ * Filter hits don't reach the replacement policy. That's fine for entry 0, the
+ * line the L1 touched last, but a hot line sitting in a victim entry would age
+ * in LRU and be evicted as if unused (with filterWays == ways, LRU would degrade
+ * to FIFO). So victim hits are recorded, and replayed into the replacement
+ * policy, in order, on the next slow path. If the record fills up, the hit takes
+ * the slow path itself. Only our core accesses the filter, and invalidations
+ * touch neither tags nor the replacement policy, so the record needs no locks.
+ *
+ * Invalidations still take filterLock. A fill holds it from the end of its
+ * access (see the childLock handling in the CC) until the filter is updated, so
+ * an invalidation of the line just filled can't slip in between and leave a
+ * stale entry behind.
+ *
+ * Accesses come with virtual addresses, but entries are tagged with physical line
+ * addresses (procMask | vLineAddr), so lines of different processes never alias.
+ * This costs an OR per access, but entries survive context switches, and
+ * invalidations (which carry physical addresses) match exactly.
  */
 
-class FilterCache : public Cache {
+class FilterCache : public CacheImpl<SetAssocArray, LRUReplPolicy<false>, DCWSOLITerminalCC> {
+    public:
+        static const uint32_t MAX_FILTER_WAYS = 4;
+
     private:
         struct FilterEntry {
-            volatile Address rdAddr;
+            volatile Address rdAddr; //physical line addresses
             volatile Address wrAddr;
             volatile uint64_t availCycle;
 
             void clear() {wrAddr = 0; rdAddr = 0; availCycle = 0;}
         };
 
-        //Replicates the most accessed line of each set in the cache
-        FilterEntry* filterArray;
+        //Variable-sized: sets hold filterWays entries, so with 1 way they are as compact as a single entry allows
+        struct FilterSet {
+            volatile uint64_t version; //odd while a writer is modifying the set
+            FilterEntry entries[1]; //filterWays of them
+
+            static uint32_t bytes(uint32_t ways) {
+                return offsetof(FilterSet, entries) + sizeof(FilterEntry)*ways;
+            }
+
+            void clear(uint32_t ways) {for (uint32_t w = 0; w < ways; w++) entries[w].clear();}
+        };
+
+        //Replicates the most recently filled lines of each set in the cache; sets are setBytes apart
+        uint8_t* filterArray;
+        uint32_t setBytes;
         Address setMask;
         uint32_t numSets;
+        uint32_t filterWays;
         uint32_t srcId; //should match the core
         uint32_t reqFlags;
 
+        //Upper-level caches private to our core, bottom-up; phase barriers walk them after this one
+        g_vector<Cache*> barrierChain;
+
+        Cache* missPath; //if set, handles accesses that miss in the filter instead of accessImpl()
+
         lock_t filterLock;
-        uint64_t fGETSHit, fGETXHit;
+        uint64_t fGETSHit, fGETXHit, fVictimHit;
+
+        //Victim hits not yet seen by the replacement policy, oldest first
+        static const uint32_t MAX_VICTIM_HITS = 16;
+        Address victimHits[MAX_VICTIM_HITS];
+        uint32_t numVictimHits;
 
     public:
-        FilterCache(uint32_t _numSets, uint32_t _numLines, CC* _cc, CacheArray* _array,
+        FilterCache(uint32_t _numSets, uint32_t _numLines, uint32_t _filterWays, CC* _cc, CacheArray* _array,
                 ReplPolicy* _rp, uint32_t _accLat, uint32_t _invLat, g_string& _name)
-            : Cache(_numLines, _cc, _array, _rp, _accLat, _invLat, _name)
+            : CacheImpl(_numLines, _cc, _array, _rp, _accLat, _invLat, _name)
         {
             numSets = _numSets;
             setMask = numSets - 1;
-            filterArray = gm_memalign<FilterEntry>(CACHE_LINE_BYTES, numSets);
-            for (uint32_t i = 0; i < numSets; i++) filterArray[i].clear();
+            filterWays = _filterWays;
+            assert_msg(filterWays >= 1 && filterWays <= MAX_FILTER_WAYS, "[%s] filter must have 1-%d ways, %d given", name.c_str(), MAX_FILTER_WAYS, filterWays);
+            setBytes = FilterSet::bytes(filterWays);
+            filterArray = gm_memalign<uint8_t>(CACHE_LINE_BYTES, numSets*setBytes);
+            for (uint32_t i = 0; i < numSets; i++) {
+                getSet(i).version = 0;
+                getSet(i).clear(filterWays);
+            }
             futex_init(&filterLock);
-            fGETSHit = fGETXHit = 0;
+            fGETSHit = fGETXHit = fVictimHit = 0;
+            numVictimHits = 0;
             srcId = -1;
             reqFlags = 0;
+            missPath = nullptr;
         }
 
         void setSourceId(uint32_t id) {
@@ -84,6 +149,14 @@ class FilterCache : public Cache {
             reqFlags = flags;
         }
 
+        void setBarrierChain(const g_vector<Cache*>& chain) {
+            barrierChain = chain;
+        }
+
+        void setMissPath(Cache* c) {
+            missPath = c;
+        }
+
         void initStats(AggregateStat* parentStat) {
             AggregateStat* cacheStat = new AggregateStat();
             cacheStat->init(name.c_str(), "Filter cache stats");
@@ -92,59 +165,120 @@ class FilterCache : public Cache {
             fgetsStat->init("fhGETS", "Filtered GETS hits", &fGETSHit);
             ProxyStat* fgetxStat = new ProxyStat();
             fgetxStat->init("fhGETX", "Filtered GETX hits", &fGETXHit);
+            ProxyStat* fvictStat = new ProxyStat();
+            fvictStat->init("fhVict", "Filtered hits on victim entries (included in fhGETS/fhGETX)", &fVictimHit);
             cacheStat->append(fgetsStat);
             cacheStat->append(fgetxStat);
+            cacheStat->append(fvictStat);
 
             initCacheStats(cacheStat);
+            if (missPath) missPath->initExtraStats(cacheStat);
             parentStat->append(cacheStat);
         }
 
         inline uint64_t load(Address vAddr, uint64_t curCycle) {
             Address vLineAddr = vAddr >> lineBits;
+            Address pLineAddr = procMask | vLineAddr;
             uint32_t idx = vLineAddr & setMask;
-            uint64_t availCycle = filterArray[idx].availCycle; //read before, careful with ordering to avoid timing races
-            if (vLineAddr == filterArray[idx].rdAddr) {
-                fGETSHit++;
-                return MAX(curCycle, availCycle);
-            } else {
-                return replace(vLineAddr, idx, true, curCycle);
+            FilterSet& set = getSet(idx);
+            uint64_t version = set.version;
+            for (uint32_t w = 0; w < filterWays; w++) {
+                if (pLineAddr == set.entries[w].rdAddr) {
+                    uint64_t availCycle = set.entries[w].availCycle;
+                    if (unlikely(set.version != version || (version & 1))) break; //raced with a writer
+                    if (w && !recordVictimHit(pLineAddr)) break; //no room to record it, take the slow path
+                    fGETSHit++;
+                    fVictimHit += (w != 0);
+                    return MAX(curCycle, availCycle);
+                }
             }
+            return replace(pLineAddr, idx, true, curCycle);
         }
 
         inline uint64_t store(Address vAddr, uint64_t curCycle) {
             Address vLineAddr = vAddr >> lineBits;
+            Address pLineAddr = procMask | vLineAddr;
             uint32_t idx = vLineAddr & setMask;
-            uint64_t availCycle = filterArray[idx].availCycle; //read before, careful with ordering to avoid timing races
-            if (vLineAddr == filterArray[idx].wrAddr) {
-                fGETXHit++;
-                //NOTE: Stores don't modify availCycle; we'll catch matches in the core
-                //filterArray[idx].availCycle = curCycle; //do optimistic store-load forwarding
-                return MAX(curCycle, availCycle);
-            } else {
-                return replace(vLineAddr, idx, false, curCycle);
+            FilterSet& set = getSet(idx);
+            uint64_t version = set.version;
+            for (uint32_t w = 0; w < filterWays; w++) {
+                if (pLineAddr == set.entries[w].wrAddr) {
+                    uint64_t availCycle = set.entries[w].availCycle;
+                    if (unlikely(set.version != version || (version & 1))) break; //raced with a writer
+                    if (w && !recordVictimHit(pLineAddr)) break; //no room to record it, take the slow path
+                    fGETXHit++;
+                    fVictimHit += (w != 0);
+                    //NOTE: Stores don't modify availCycle; we'll catch matches in the core
+                    //filterArray[idx].availCycle = curCycle; //do optimistic store-load forwarding
+                    return MAX(curCycle, availCycle);
+                }
             }
+            return replace(pLineAddr, idx, false, curCycle);
         }
 
-        uint64_t replace(Address vLineAddr, uint32_t idx, bool isLoad, uint64_t curCycle) {
-            Address pLineAddr = procMask | vLineAddr;
+        uint64_t replace(Address pLineAddr, uint32_t idx, bool isLoad, uint64_t curCycle) {
 //            MESIState dummyState = MESIState::I;
             DCWSOLIState dummyState = DCWSOLIState::I;
             futex_lock(&filterLock);
             MemReq req = {pLineAddr, isLoad? GETS : GETX, 0, &dummyState, curCycle, &filterLock, dummyState, srcId, reqFlags};
-            uint64_t respCycle  = access(req);
+            replayVictimHits(req);
+            uint64_t respCycle;
+            Address evictedLineAddr;
+            if (likely(!missPath)) {
+                respCycle = accessImpl(req);
+                evictedLineAddr = lastEvictedLineAddr;
+            } else {
+                respCycle = missPath->access(req);
+                evictedLineAddr = missPath->getLastEvictedLineAddr();
+            }
 
             //Due to the way we do the locking, at this point the old address might be invalidated, but we have the new address guaranteed until we release the lock
 
-            //Careful with this order
-            Address oldAddr = filterArray[idx].rdAddr;
-            filterArray[idx].wrAddr = isLoad? -1L : vLineAddr;
-            filterArray[idx].rdAddr = vLineAddr;
+            FilterSet& set = getSet(idx);
+            startWrite(set);
+
+            //The access may have evicted another line of this set from the cache; it can't stay in the filter
+            if (evictedLineAddr) {
+                for (uint32_t w = 0; w < filterWays; w++) {
+                    if (set.entries[w].rdAddr == evictedLineAddr) set.entries[w].clear();
+                }
+            }
+
+            //Move the line to the front, pushing the others back. If the line was not in the filter, it takes
+            //the first free entry, or the last one falls off
+            uint32_t pos = filterWays - 1;
+            bool found = false;
+            for (uint32_t w = 0; w < filterWays; w++) {
+                if (set.entries[w].rdAddr == pLineAddr) {
+                    pos = w;
+                    found = true;
+                    break;
+                }
+            }
+            for (uint32_t w = 0; w < filterWays && !found; w++) {
+                Address a = set.entries[w].rdAddr;
+                if (a == 0 || a == (Address)-1L) {
+                    pos = w;
+                    break;
+                }
+            }
+            Address oldAddr = set.entries[pos].rdAddr;
+            uint64_t oldAvailCycle = set.entries[pos].availCycle;
+            for (uint32_t w = pos; w > 0; w--) {
+                set.entries[w].rdAddr = set.entries[w-1].rdAddr;
+                set.entries[w].wrAddr = set.entries[w-1].wrAddr;
+                set.entries[w].availCycle = set.entries[w-1].availCycle;
+            }
+
+            set.entries[0].wrAddr = isLoad? -1L : pLineAddr;
+            set.entries[0].rdAddr = pLineAddr;
 
             //For LSU simulation purposes, loads bypass stores even to the same line if there is no conflict,
             //(e.g., st to x, ld from x+8) and we implement store-load forwarding at the core.
             //So if this is a load, it always sets availCycle; if it is a store hit, it doesn't
-            if (oldAddr != vLineAddr) filterArray[idx].availCycle = respCycle;
+            set.entries[0].availCycle = (oldAddr != pLineAddr)? respCycle : oldAvailCycle;
 
+            endWrite(set);
             futex_unlock(&filterLock);
             return respCycle;
         }
@@ -153,18 +287,68 @@ class FilterCache : public Cache {
             Cache::startInvalidate();  // grabs cache's downLock
             futex_lock(&filterLock);
             uint32_t idx = req.lineAddr & setMask; //works because of how virtual<->physical is done...
-            if ((filterArray[idx].rdAddr | procMask) == req.lineAddr) { //FIXME: If another process calls invalidate(), procMask will not match even though we may be doing a capacity-induced invalidation!
-                filterArray[idx].wrAddr = -1L;
-                filterArray[idx].rdAddr = -1L;
+            FilterSet& set = getSet(idx);
+            for (uint32_t w = 0; w < filterWays; w++) {
+                if (set.entries[w].rdAddr == req.lineAddr) { //tags are physical, so this is right no matter which process is invalidating
+                    startWrite(set);
+                    set.entries[w].wrAddr = -1L;
+                    set.entries[w].rdAddr = -1L;
+                    endWrite(set);
+                }
             }
             uint64_t respCycle = Cache::finishInvalidate(req); // releases cache's downLock
             futex_unlock(&filterLock);
             return respCycle;
         }
 
-        void contextSwitch() {
+        //Phase barrier on the whole private hierarchy of our core. Returns the cycle where the barrier completes
+        uint64_t barrier(uint64_t curCycle) {
+            uint64_t respCycle = Cache::barrier(curCycle, srcId);
+            for (Cache* c : barrierChain) respCycle = c->barrier(respCycle, srcId);
+
+            //Lines have changed state under the filter (e.g., D->C must miss on the next store), so flush it
+            flush();
+            return respCycle;
+        }
+
+        //Entries are tagged with their process, so they stay valid across context switches
+        void contextSwitch() {}
+
+    private:
+        inline FilterSet& getSet(uint32_t idx) {
+            return *reinterpret_cast<FilterSet*>(filterArray + idx*setBytes);
+        }
+
+        inline bool recordVictimHit(Address pLineAddr) {
+            if (numVictimHits && victimHits[numVictimHits-1] == pLineAddr) return true;
+            if (numVictimHits == MAX_VICTIM_HITS) return false;
+            victimHits[numVictimHits++] = pLineAddr;
+            return true;
+        }
+
+        //Lines that left the cache since their hit are skipped
+        void replayVictimHits(const MemReq& req) {
+            for (uint32_t i = 0; i < numVictimHits; i++) typedArray->lookupAs(typedRP, victimHits[i], &req, true);
+            numVictimHits = 0;
+        }
+
+        //Writers must hold filterLock. Stores are not reordered on x86, and the fields are volatile, so no fences needed
+        inline void startWrite(FilterSet& set) {
+            set.version++;
+        }
+
+        inline void endWrite(FilterSet& set) {
+            set.version++;
+        }
+
+        void flush() {
             futex_lock(&filterLock);
-            for (uint32_t i = 0; i < numSets; i++) filterArray[i].clear();
+            for (uint32_t i = 0; i < numSets; i++) {
+                FilterSet& set = getSet(i);
+                startWrite(set);
+                set.clear(filterWays);
+                endWrite(set);
+            }
             futex_unlock(&filterLock);
         }
 };
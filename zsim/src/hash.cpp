@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include "log.h"
 #include "mtrand.h"
+#include "pad.h"
 
 H3HashFamily::H3HashFamily(uint32_t numFunctions, uint32_t outputBits, uint64_t randSeed) : numFuncs(numFunctions) {
     MTRand rnd(randSeed);
@@ -59,13 +60,46 @@ H3HashFamily::H3HashFamily(uint32_t numFunctions, uint32_t outputBits, uint64_t
             hMatrix[ii*words + jj] = val;
         }
     }
+
+    table = gm_memalign<uint64_t>(CACHE_LINE_BYTES, 8*256*numFuncs);
+    for (uint32_t b = 0; b < 8; b++) {
+        for (uint32_t v = 0; v < 256; v++) {
+            for (uint32_t ii = 0; ii < numFuncs; ii++) {
+                table[(b*256 + v)*numFuncs + ii] = matrixHash(ii, ((uint64_t)v) << (8*b));
+            }
+        }
+    }
 }
 
 H3HashFamily::~H3HashFamily() {
     gm_free(hMatrix);
+    gm_free(table);
+}
+
+uint64_t H3HashFamily::hash(uint32_t id, uint64_t val) {
+    assert(id < numFuncs);
+    const uint64_t* t = &table[id];
+    uint32_t s = numFuncs;
+    // Two independent XOR chains for ILP
+    uint64_t r0 = t[(0*256 + (val & 0xff))*s] ^ t[(1*256 + ((val >> 8) & 0xff))*s];
+    uint64_t r1 = t[(2*256 + ((val >> 16) & 0xff))*s] ^ t[(3*256 + ((val >> 24) & 0xff))*s];
+    r0 ^= t[(4*256 + ((val >> 32) & 0xff))*s] ^ t[(5*256 + ((val >> 40) & 0xff))*s];
+    r1 ^= t[(6*256 + ((val >> 48) & 0xff))*s] ^ t[(7*256 + (val >> 56))*s];
+    return r0 ^ r1;
+}
+
+void H3HashFamily::hashAll(uint64_t val, uint64_t* out, uint32_t n) {
+    assert(n <= numFuncs);
+    for (uint32_t i = 0; i < n; i++) out[i] = 0;
+    for (uint32_t b = 0; b < 8; b++) {
+        const uint64_t* row = &table[(b*256 + ((val >> (8*b)) & 0xff))*numFuncs];
+        for (uint32_t i = 0; i < n; i++) out[i] ^= row[i];
+    }
 }
 
-/* NOTE: This is fairly well hand-optimized. Go to the commit logs to see the speedup of this function. Main things:
+/* Bit-serial H3, only used to build the byte tables now.
+ *
+ * NOTE: This is fairly well hand-optimized. Go to the commit logs to see the speedup of this function. Main things:
  * 1. resShift indicates how many bits of output are computed (64, 32, 16, or 8). With less than 64 bits, several rounds are folded at the end.
  * 2. The output folding does not mask, the output is expected to be masked by caller.
  * 3. The main loop is hand-unrolled and optimized for ILP.
@@ -77,7 +111,7 @@ H3HashFamily::~H3HashFamily() {
  *     res = (res << 1) | (res >> 63);
  * }
  */
-uint64_t H3HashFamily::hash(uint32_t id, uint64_t val) {
+uint64_t H3HashFamily::matrixHash(uint32_t id, uint64_t val) const {
     uint64_t res = 0;
     assert(id >= 0 && id < numFuncs);
 
@@ -35,17 +35,31 @@ class HashFamily : public GlobAlloc {
         virtual ~HashFamily() {}
 
         virtual uint64_t hash(uint32_t id, uint64_t val) = 0;
+
+        //Computes functions 0..n-1 on val (out[i] = hash(i, val)). Override when doing them together is cheaper
+        virtual void hashAll(uint64_t val, uint64_t* out, uint32_t n) {
+            for (uint32_t i = 0; i < n; i++) out[i] = hash(i, val);
+        }
 };
 
+/* H3 is linear over GF(2): the hash of a value is the XOR of the hashes of its bytes in place.
+ * So instead of going bit by bit over the matrix, we precompute the hash of every byte value at
+ * every byte position (8x256 entries per function), and a hash is 8 lookups and 7 XORs. The
+ * table is laid out [byte][value][function], so hashAll() reads contiguous entries.
+ */
 class H3HashFamily : public HashFamily {
     private:
         const uint32_t numFuncs;
         uint32_t resShift;
         uint64_t* hMatrix;
+        uint64_t* table;
+
+        uint64_t matrixHash(uint32_t id, uint64_t val) const; //bit-serial reference, used to fill the table
     public:
         H3HashFamily(uint32_t numFunctions, uint32_t outputBits, uint64_t randSeed = 123132127);
         virtual ~H3HashFamily();
         uint64_t hash(uint32_t id, uint64_t val);
+        void hashAll(uint64_t val, uint64_t* out, uint32_t n);
 };
 
 class SHA1HashFamily : public HashFamily {
@@ -65,6 +79,9 @@ class SHA1HashFamily : public HashFamily {
 class IdHashFamily : public HashFamily {
     public:
         inline uint64_t hash(uint32_t id, uint64_t val) {return val;}
+        void hashAll(uint64_t val, uint64_t* out, uint32_t n) {
+            for (uint32_t i = 0; i < n; i++) out[i] = val;
+        }
 };
 
 #endif  // HASH_H_
@@ -110,6 +110,8 @@ class IdealLRUArray : public CacheArray {
             lruList.push_front(e);
         }
 
+        Address getLineAddr(uint32_t lineId) {return array[lineId].lineAddr;}
+
         ReplPolicy* getRP() const {return rp;}
         void setCC(CC* _cc) {cc = _cc;}
 };
@@ -279,6 +281,8 @@ class IdealLRUPartArray : public CacheArray {
             rp->replaced(lineId);
             rp->update(lineId, req);
         }
+
+        Address getLineAddr(uint32_t lineId) {return lineAddrs[lineId];}
 };
 
 #endif  // IDEAL_ARRAYS_H_
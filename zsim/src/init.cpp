@@ -25,6 +25,7 @@
  */
 
 #include "init.h"
+#include <algorithm>
 #include <list>
 #include <sstream>
 #include <stdlib.h>
@@ -33,6 +34,7 @@
 #include <vector>
 #include "cache.h"
 #include "cache_arrays.h"
+#include "cache_impl.h"
 #include "config.h"
 #include "constants.h"
 #include "contention_sim.h"
@@ -308,18 +310,47 @@ BaseCache* BuildCacheBank(Config& config, const string& prefix, g_string& name,
     bool nonInclusiveHack = config.get<bool>(prefix + "nonInclusiveHack", false);
     if (nonInclusiveHack) assert(type == "Simple" && !isTerminal);
 
+    // Directory format (sharer sets kept for our children)
+    string dirFormat = config.get<const char*>(prefix + "dirFormat", "FullMap");
+    SharerFormat::Type dirType;
+    if (dirFormat == "FullMap") {
+        dirType = SharerFormat::FULL_MAP;
+    } else if (dirFormat == "LimitedPtr") {
+        dirType = SharerFormat::LIMITED_PTR;
+        if (nonInclusiveHack) panic("%s: LimitedPtr directories need exact sharer tracking, can't use nonInclusiveHack", name.c_str());
+    } else if (dirFormat == "Clustered") {
+        dirType = SharerFormat::CLUSTERED;
+        if (nonInclusiveHack) panic("%s: Clustered directories need exact sharer tracking, can't use nonInclusiveHack", name.c_str());
+    } else {
+        panic("%s: Invalid directory format %s", name.c_str(), dirFormat.c_str());
+    }
+    uint32_t dirPointers = (dirType == SharerFormat::LIMITED_PTR)? config.get<uint32_t>(prefix + "dirPointers", 4) : 0;
+    uint32_t dirClusters = (dirType == SharerFormat::CLUSTERED)? config.get<uint32_t>(prefix + "dirClusters", MAX_CACHE_CHILDREN) : 0;
+
     // Finally, build the cache
     Cache* cache;
     CC* cc;
     if (isTerminal) {
         cc = new DCWSOLITerminalCC(numLines, name);
     } else {
-        cc = new DCWSOLICC(numLines, nonInclusiveHack, name);
+        cc = new DCWSOLICC(numLines, nonInclusiveHack, SharerFormat(dirType, dirPointers, dirClusters), name);
     }
     rp->setCC(cc);
     if (!isTerminal) {
         if (type == "Simple") {
-            cache = new Cache(numLines, cc, array, rp, accLat, invLat, name);
+            //Devirtualize the common configurations; everything else takes the generic path
+            const std::type_info& rpType = typeid(*rp);
+            if (arrayType != "SetAssoc") {
+                cache = new Cache(numLines, cc, array, rp, accLat, invLat, name);
+            } else if (rpType == typeid(LRUReplPolicy<true>)) {
+                cache = new CacheImpl<SetAssocArray, LRUReplPolicy<true>, DCWSOLICC>(numLines, cc, array, rp, accLat, invLat, name);
+            } else if (rpType == typeid(LRUReplPolicy<false>)) {
+                cache = new CacheImpl<SetAssocArray, LRUReplPolicy<false>, DCWSOLICC>(numLines, cc, array, rp, accLat, invLat, name);
+            } else if (rpType == typeid(SRRIPReplPolicy)) {
+                cache = new CacheImpl<SetAssocArray, SRRIPReplPolicy, DCWSOLICC>(numLines, cc, array, rp, accLat, invLat, name);
+            } else {
+                cache = new Cache(numLines, cc, array, rp, accLat, invLat, name);
+            }
         } else if (type == "Timing") {
             uint32_t mshrs = config.get<uint32_t>(prefix + "mshrs", 16);
             uint32_t tagLat = config.get<uint32_t>(prefix + "tagLat", 5);
@@ -333,10 +364,30 @@ BaseCache* BuildCacheBank(Config& config, const string& prefix, g_string& name,
             panic("Invalid cache type %s", type.c_str());
         }
     } else {
-        //Filter cache optimization
-        if (type != "Simple") panic("Terminal cache %s can only have type == Simple", name.c_str());
+        //Filter cache optimization. Timing and Tracing L1s keep the filter for hits, and use that type of cache for the rest
         if (arrayType != "SetAssoc" || hashType != "None" || replType != "LRU") panic("Invalid FilterCache config %s", name.c_str());
-        cache = new FilterCache(numSets, numLines, cc, array, rp, accLat, invLat, name);
+        uint32_t filterWays = config.get<uint32_t>(prefix + "filterWays", 1); //lines per set in the L0 filter
+        uint32_t maxFilterWays = MIN(ways, (uint32_t)FilterCache::MAX_FILTER_WAYS);
+        if (filterWays < 1 || filterWays > maxFilterWays) {
+            panic("%s: filterWays must be between 1 and %d, %d given", name.c_str(), maxFilterWays, filterWays);
+        }
+        FilterCache* fc = new FilterCache(numSets, numLines, filterWays, cc, array, rp, accLat, invLat, name);
+        if (type == "Simple") {
+            //fast path, nothing to add
+        } else if (type == "Timing") {
+            uint32_t mshrs = config.get<uint32_t>(prefix + "mshrs", 4);
+            uint32_t tagLat = config.get<uint32_t>(prefix + "tagLat", 1);
+            fc->setMissPath(new TimingCache(numLines, cc, array, rp, accLat, invLat, mshrs, tagLat, ways, ways /*SetAssoc, no repl walk*/, domain, name));
+        } else if (type == "Tracing") {
+            g_string traceFile = config.get<const char*>(prefix + "traceFile","");
+            if (traceFile.empty()) traceFile = g_string(zinfo->outputDir) + "/" + name + ".trace";
+            TracingCache* tc = new TracingCache(numLines, cc, array, rp, accLat, invLat, traceFile, name);
+            tc->initTraceWriter(1); //our only child is the core
+            fc->setMissPath(tc);
+        } else {
+            panic("Invalid cache type %s", type.c_str());
+        }
+        cache = fc;
     }
 
 #if 0
@@ -354,9 +405,17 @@ DDRMemory* BuildDDRMemory(Config& config, uint32_t lineSize, uint32_t frequency,
     uint32_t pageSize = config.get<uint32_t>(prefix + "pageSize", 8*1024);  // 1Kb cols, x4 devices
     const char* tech = config.get<const char*>(prefix + "tech", "DDR3-1333-CL10");  // see cpp file for other techs
     const char* addrMapping = config.get<const char*>(prefix + "addrMapping", "rank:col:bank");  // address splitter interleaves channels; row always on top
+    // Rank/bank index hashing with the row: None, XOR or Permutation (see addr_mapping.h)
+    const char* bankHash = config.get<const char*>(prefix + "bankHash", "None");
+    // Both can be set per controller, e.g., sys.mem.mem-1.addrMapping
+    string ctrlPrefix = prefix + name.c_str() + ".";
+    addrMapping = config.get<const char*>(ctrlPrefix + "addrMapping", addrMapping);
+    bankHash = config.get<const char*>(ctrlPrefix + "bankHash", bankHash);
 
     // If set, writes are deferred and bursted out to reduce WTR overheads
     bool deferWrites = config.get<bool>(prefix + "deferWrites", true);
+    // If set, deferred writes are batched by row past maxRowHits, since they've been acked already
+    bool batchWrites = config.get<bool>(prefix + "batchWrites", false);
     bool closedPage = config.get<bool>(prefix + "closedPage", true);
     bool isNVM = string(tech).find("NVM") != string::npos;
 
@@ -364,13 +423,20 @@ DDRMemory* BuildDDRMemory(Config& config, uint32_t lineSize, uint32_t frequency,
     // Balances throughput and fairness; 0 -> FCFS / high (e.g., -1) -> pure FR-FCFS
     uint32_t maxRowHits = config.get<uint32_t>(prefix + "maxRowHits", 4);
 
+    // Scheduling policy: FRFCFS, PARBS, ATLAS or BLISS (see mem_sched.h)
+    const char* scheduler = config.get<const char*>(prefix + "scheduler", "FRFCFS");
+
     // Request queues
     uint32_t queueDepth = config.get<uint32_t>(prefix + "queueDepth", 16);
+    uint32_t writeQueueDepth = config.get<uint32_t>(prefix + "writeQueueDepth", queueDepth);
+    // Write arrival rate, as a % of peak bus bandwidth, above which we're in a write burst and
+    // start draining writes early (with deferWrites). 0 (the default) disables burst detection.
+    uint32_t writeBurstRate = config.get<uint32_t>(prefix + "writeBurstRate", 0);
     uint32_t controllerLatency = config.get<uint32_t>(prefix + "controllerLatency", 10);  // in system cycles
 
     auto mem = new DDRMemory(zinfo->lineSize, pageSize, ranksPerChannel, banksPerRank, frequency, tech,
-                             addrMapping, controllerLatency, queueDepth, maxRowHits, deferWrites,
-                             closedPage, isNVM, domain, name);
+                             addrMapping, bankHash, controllerLatency, queueDepth, writeQueueDepth, maxRowHits, deferWrites,
+                             batchWrites, closedPage, isNVM, scheduler, writeBurstRate, domain, name);
     return mem;
 }
 
@@ -413,7 +479,9 @@ MemObject* BuildMemoryController(Config& config, uint32_t lineSize, uint32_t fre
     } else if (type == "Detailed") {
         // FIXME(dsm): Don't use a separate config file... see DDRMemory
         g_string mcfg = config.get<const char*>("sys.mem.paramFile", "");
-        mem = new MemControllerBase(mcfg, lineSize, frequency, domain, name);
+        const char* scheduler = config.get<const char*>("sys.mem.scheduler", "FRFCFS");
+        uint32_t maxRowHits = config.get<uint32_t>("sys.mem.maxRowHits", -1);  // unlimited by default
+        mem = new MemControllerBase(mcfg, lineSize, frequency, scheduler, maxRowHits, domain, name);
     } else {
         panic("Invalid memory controller type %s", type.c_str());
     }
@@ -431,13 +499,17 @@ CacheGroup* BuildCacheGroup(Config& config, const string& name, bool isTerminal)
     bool isPrefetcher = config.get<bool>(prefix + "isPrefetcher", false);
     if (isPrefetcher) { //build a prefetcher group
         uint32_t prefetchers = config.get<uint32_t>(prefix + "prefetchers", 1);
+        uint32_t startLevel = config.get<uint32_t>(prefix + "startLevel", 1);
+        // If set, stores train streams too, so store streams get prefetched (always with GETS, see StreamPrefetcher)
+        bool storeTraining = config.get<bool>(prefix + "storeTraining", false);
+        uint32_t throttleLoad = config.get<uint32_t>(prefix + "throttleLoad", 75);
         cg.resize(prefetchers);
         for (vector<BaseCache*>& bg : cg) bg.resize(1);
         for (uint32_t i = 0; i < prefetchers; i++) {
             stringstream ss;
             ss << name << "-" << i;
             g_string pfName(ss.str().c_str());
-            cg[i][0] = new StreamPrefetcher(pfName);
+            cg[i][0] = new StreamPrefetcher(pfName, startLevel, storeTraining, throttleLoad);
         }
         return cgp;
     }
@@ -563,14 +635,32 @@ static void InitSystem(Config& config) {
     if (memControllers > 1) {
         bool splitAddrs = config.get<bool>("sys.mem.splitAddrs", true);
         if (splitAddrs) {
-            MemObject* splitter = new SplitAddrMemory(mems, "mem-splitter");
+            // Channel index hashing: None (interleave), XOR or Permutation (needs pow2 controllers)
+            const char* channelHash = config.get<const char*>("sys.mem.channelHash", "None");
+            MemObject* splitter = new SplitAddrMemory(mems, channelHash, "mem-splitter");
             mems.resize(1);
             mems[0] = splitter;
         }
     }
 
+    //Prefetchers throttle themselves when memory queues fill up. Without an address splitter, LLC banks
+    //pick controllers with their own hash, so we can't tell which controller serves a line; don't throttle.
+    if (mems.size() == 1) {
+        for (const char* grp : cacheGroupNames) {
+            for (vector<BaseCache*>& bg : *cMap[grp]) {
+                for (BaseCache* bank : bg) {
+                    StreamPrefetcher* pf = dynamic_cast<StreamPrefetcher*>(bank);
+                    if (pf) pf->setMemory(mems[0]);
+                }
+            }
+        }
+    } else {
+        info("%ld memory controllers without splitAddrs, prefetchers won't throttle on memory load", mems.size());
+    }
+
     //Connect everything
     bool printHierarchy = config.get<bool>("sim.printHierarchy", false);
+    unordered_map<BaseCache*, vector<BaseCache*>> bankParents; //used to find each core's private caches
 
     // mem to llc is a bit special, only one llc
     uint32_t childId = 0;
@@ -627,6 +717,7 @@ static void InitSystem(Config& config) {
                 for (BaseCache* bank : childCaches[c]) {
                     bank->setParents(childId++, parentsVec, network);
                     childrenVec.push_back(bank);
+                    bankParents[bank].insert(bankParents[bank].end(), parentCaches[p].begin(), parentCaches[p].end());
                 }
             }
 
@@ -662,6 +753,10 @@ static void InitSystem(Config& config) {
     for (const char* grp : cacheGroupNames) if (isTerminal(grp)) assignedCaches[grp] = 0;
 
     if (!zinfo->traceDriven) {
+        //Terminal caches of each core, used to find the caches private to it
+        vector<pair<BaseCache*, uint32_t>> terminalOwners;
+        vector<pair<FilterCache*, uint32_t>> coreDCaches;
+
         //Instantiate the cores
         vector<const char*> coreGroupNames;
         unordered_map <string, vector<Core*>> coreMap;
@@ -731,6 +826,10 @@ static void InitSystem(Config& config) {
                     dc->setSourceId(coreIdx);
                     assignedCaches[dcache]++;
 
+                    terminalOwners.push_back(std::make_pair(ic, coreIdx));
+                    terminalOwners.push_back(std::make_pair(dc, coreIdx));
+                    coreDCaches.push_back(std::make_pair(dc, coreIdx));
+
                     //Build the core
                     if (type == "Simple") {
                         core = new (&simpleCores[j]) SimpleCore(ic, dc, name);
@@ -770,11 +869,46 @@ static void InitSystem(Config& config) {
             }
         }
 
+        //Find the caches private to each core (all the terminal caches below them belong to that core); phase barriers walk them
+        unordered_map<BaseCache*, int64_t> bankOwner; //-1 if shared
+        for (auto& to : terminalOwners) {
+            vector<BaseCache*> fringe = {to.first};
+            while (!fringe.empty()) {
+                BaseCache* bank = fringe.back();
+                fringe.pop_back();
+                for (BaseCache* parent : bankParents[bank]) {
+                    auto it = bankOwner.find(parent);
+                    if (it == bankOwner.end()) bankOwner[parent] = to.second;
+                    else if (it->second != -1 && it->second != to.second) it->second = -1;
+                    else continue; //ancestors already know about this owner
+                    fringe.push_back(parent);
+                }
+            }
+        }
+
+        for (auto& cd : coreDCaches) {
+            FilterCache* dc = cd.first;
+            g_vector<Cache*> chain;
+            vector<BaseCache*> visited;
+            list<BaseCache*> fringe(bankParents[dc].begin(), bankParents[dc].end()); //FIFO, so the chain is bottom-up
+            while (!fringe.empty()) {
+                BaseCache* bank = fringe.front();
+                fringe.pop_front();
+                if (bankOwner[bank] != cd.second || std::find(visited.begin(), visited.end(), bank) != visited.end()) continue;
+                visited.push_back(bank);
+                Cache* cache = dynamic_cast<Cache*>(bank); //skips prefetchers and other pass-through objects
+                if (cache) chain.push_back(cache);
+                fringe.insert(fringe.end(), bankParents[bank].begin(), bankParents[bank].end());
+            }
+            dc->setBarrierChain(chain);
+        }
+
         //Populate global core info
         assert(zinfo->numCores == coreIdx);
         zinfo->cores = gm_memalign<Core*>(CACHE_LINE_BYTES, zinfo->numCores);
         coreIdx = 0;
         for (const char* group : coreGroupNames) for (Core* core : coreMap[group]) zinfo->cores[coreIdx++] = core;
+        zinfo->coreBarriers = gm_calloc<uint64_t>(zinfo->numCores);
 
         //Init stats: cores
         for (const char* group : coreGroupNames) {
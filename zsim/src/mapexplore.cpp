@@ -0,0 +1,204 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Offline address-mapping explorer. Replays an access trace (e.g., from a
+ * tracing LLC, sorted with sorttrace) against candidate channel/rank/bank
+ * mappings, and reports row hit and bank conflict rates and how evenly
+ * accesses spread over banks and channels. This is a first-order model: each
+ * bank keeps its last row open, and accesses are served in trace order, with
+ * no scheduler reordering and no timing. It's meant to quickly discard
+ * mappings that concentrate the workload on a few banks before long runs.
+ *
+ * A tracing LLC logs its inputs, not what reaches memory: its hits, and the
+ * writebacks (PUTs) it absorbs, would all count as DRAM accesses. So the trace
+ * is first filtered through a simple LLC model of the given size (see
+ * LLCModel), and only its misses and dirty evictions are replayed. A size of 0
+ * skips the model, for traces taken on the memory side.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "access_tracing.h"
+#include "addr_mapping.h"
+#include "config.h"  // for Tokenize
+#include "galloc.h"
+
+using namespace std;
+
+struct Candidate {
+    string spec;
+    ChannelMapping chMap;
+    DRAMAddrMapping addrMap;
+
+    vector<uint64_t> openRows;  // indexed by global bank, -1 if closed
+    vector<uint64_t> bankAccs;
+    vector<uint64_t> chAccs;
+    uint64_t accs, hits, conflicts;  // conflicts are misses that close another row
+};
+
+/* First-order LLC: set-associative, LRU, write-back, and allocating on both
+ * misses and writebacks. It doesn't model inclusion or banking, so give it the
+ * total capacity of the traced LLC banks.
+ */
+class LLCModel {
+    private:
+        uint32_t ways;
+        uint64_t sets;
+        vector<Address> tags;  // 0 if invalid
+        vector<uint64_t> stamps;  // last use, for LRU
+        vector<bool> dirty;
+        uint64_t timestamp;
+
+    public:
+        uint64_t accs, misses, dirtyEvictions;
+
+        LLCModel(uint64_t lines, uint32_t _ways) : ways(_ways), sets(lines/_ways), tags(lines, 0), stamps(lines, 0),
+            dirty(lines, false), timestamp(1), accs(0), misses(0), dirtyEvictions(0) {}
+
+        // Applies an access, and appends the line addresses it fetches from or writes back to memory to memAccs
+        void access(const AccessRecord& acc, vector<Address>& memAccs) {
+            accs++;
+            // Shifted by one so line 0 doesn't look invalid
+            Address tag = acc.lineAddr + 1;
+            uint64_t first = (acc.lineAddr % sets)*ways;
+            uint64_t victim = first;
+            for (uint64_t i = first; i < first + ways; i++) {
+                if (tags[i] == tag) {
+                    if (acc.type != PUTS) stamps[i] = timestamp++;  // clean evictions from above don't make the line hotter
+                    if (acc.type == PUTX) dirty[i] = true;
+                    return;
+                }
+                if (stamps[i] < stamps[victim]) victim = i;
+            }
+
+            if (acc.type == PUTS) return;  // clean, and we don't have it: nothing to do
+            misses++;
+            if (acc.type != PUTX) memAccs.push_back(acc.lineAddr);  // a PUTX brings the whole line, no fetch needed
+            if (tags[victim] && dirty[victim]) {
+                memAccs.push_back(tags[victim] - 1);
+                dirtyEvictions++;
+            }
+            tags[victim] = tag;
+            stamps[victim] = timestamp++;
+            dirty[victim] = (acc.type == PUTX);
+        }
+};
+
+static double imbalance(const vector<uint64_t>& accs) {
+    uint64_t total = 0, max = 0;
+    for (uint64_t a : accs) {
+        total += a;
+        if (a > max) max = a;
+    }
+    return total? ((double) max)*accs.size()/total : 0.0;
+}
+
+int main(int argc, const char* argv[]) {
+    InitLog(""); //no log header
+    const int FIRST_CAND = 9;  // argv index of the first mapping
+    if (argc <= FIRST_CAND) {
+        info("Replays an access trace against candidate DRAM address mappings");
+        info("Usage: %s <trace> <llcKB> <llcWays> <channels> <ranksPerChannel> <banksPerRank> <pageSize> <lineSize> <mapping>[/<bankHash>[/<channelHash>]] ...", argv[0]);
+        info("  trace comes from a tracing LLC, and is filtered through an LRU LLC model of llcKB KB (all banks) and llcWays ways,");
+        info("  so that only its misses and dirty evictions reach memory. Use llcKB 0 for a trace of memory-side accesses");
+        info("  mapping is a sys.mem.addrMapping string (e.g., rank:col:bank), hashes are None, XOR or Permutation");
+        info("  e.g.: %s trace.h5 8192 16 4 4 8 8192 64 rank:col:bank rank:col:bank/XOR rank:col:bank/Permutation/XOR", argv[0]);
+        exit(1);
+    }
+
+    gm_init(32<<20 /*32 MB, should be enough*/);
+    uint64_t llcKB = atol(argv[2]);
+    uint32_t llcWays = atoi(argv[3]);
+    uint32_t channels = atoi(argv[4]);
+    uint32_t ranksPerChannel = atoi(argv[5]);
+    uint32_t banksPerRank = atoi(argv[6]);
+    uint32_t pageSize = atoi(argv[7]);
+    uint32_t lineSize = atoi(argv[8]);
+    uint32_t banksPerChannel = ranksPerChannel*banksPerRank;
+    if (!channels || !banksPerChannel || !pageSize || !lineSize) panic("Invalid memory geometry");
+
+    if (llcKB && (!llcWays || llcKB*1024/lineSize < llcWays)) panic("Invalid LLC geometry (%ld KB, %d ways)", llcKB, llcWays);
+    LLCModel* llc = llcKB? new LLCModel(llcKB*1024/lineSize, llcWays) : nullptr;
+
+    vector<Candidate> cands(argc - FIRST_CAND);
+    for (uint32_t i = 0; i < cands.size(); i++) {
+        Candidate& c = cands[i];
+        c.spec = argv[i + FIRST_CAND];
+        vector<string> tokens;
+        Tokenize(c.spec, tokens, "/");
+        if (tokens.empty() || tokens.size() > 3) panic("Invalid candidate %s", c.spec.c_str());
+        const char* bankHash = (tokens.size() > 1)? tokens[1].c_str() : "None";
+        const char* channelHash = (tokens.size() > 2)? tokens[2].c_str() : "None";
+        c.addrMap.init(tokens[0].c_str(), bankHash, lineSize, pageSize, ranksPerChannel, banksPerRank);
+        c.chMap.init(channels, channelHash);
+        c.openRows.resize(channels*banksPerChannel, -1ul);
+        c.bankAccs.resize(channels*banksPerChannel, 0);
+        c.chAccs.resize(channels, 0);
+        c.accs = c.hits = c.conflicts = 0;
+    }
+
+    AccessTraceReader tr(argv[1]);
+    info("Replaying %ld records against %ld mappings", tr.getNumRecords(), cands.size());
+    vector<Address> memAccs;
+    while (!tr.empty()) {
+        AccessRecord acc = tr.read();
+        memAccs.clear();
+        if (llc) llc->access(acc, memAccs);
+        else if (acc.type != PUTS) memAccs.push_back(acc.lineAddr);  // clean writebacks don't reach memory
+
+        for (Address lineAddr : memAccs) {
+            for (Candidate& c : cands) {
+                uint32_t ch = c.chMap.channel(lineAddr);
+                DRAMAddrLoc l = c.addrMap.map(c.chMap.ctrlAddr(lineAddr));
+                uint32_t bank = ch*banksPerChannel + l.rank*banksPerRank + l.bank;
+                uint64_t& openRow = c.openRows[bank];
+                if (openRow == l.row) c.hits++;
+                else if (openRow != -1ul) c.conflicts++;
+                openRow = l.row;
+                c.accs++;
+                c.bankAccs[bank]++;
+                c.chAccs[ch]++;
+            }
+        }
+    }
+
+    if (llc) {
+        info("LLC model: %ld accesses, %ld misses (%.2f%%), %ld dirty evictions", llc->accs, llc->misses,
+                100.0*llc->misses/(llc->accs? llc->accs : 1), llc->dirtyEvictions);
+    }
+
+    // Imbalance is the busiest bank's (channel's) share of accesses over a uniform share; 1.0 is perfectly even
+    info("%-40s %12s %8s %8s %8s %8s", "Mapping", "Accesses", "RowHit%", "Confl%", "BankImb", "ChImb");
+    for (Candidate& c : cands) {
+        double accs = c.accs? c.accs : 1;
+        info("%-40s %12ld %8.2f %8.2f %8.2f %8.2f", c.spec.c_str(), c.accs, 100.0*c.hits/accs, 100.0*c.conflicts/accs,
+                imbalance(c.bankAccs), imbalance(c.chAccs));
+    }
+
+    return 0;
+}
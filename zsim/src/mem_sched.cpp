@@ -0,0 +1,298 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mem_sched.h"
+#include <algorithm>
+#include <string.h>
+#include "bithacks.h"
+#include "log.h"
+
+MemSchedPolicy::MemSchedPolicy(uint32_t _numSources, uint32_t _numBanks, uint32_t _rowHitCap, uint32_t _baseLatency)
+    : numSources(_numSources), numBanks(_numBanks), rowHitCap(_rowHitCap), baseLatency(MAX(_baseLatency, 1u)),
+      nextSeq(0), writesIssued(0)
+{
+    assert(numSources > 0 && numBanks > 0);
+}
+
+void MemSchedPolicy::initStats(AggregateStat* parentStat, const char* statName) {
+    AggregateStat* s = new AggregateStat();
+    s->init(statName, "Scheduler stats");
+    profReads.init("srcRd", "Reads issued, per source", numSources); s->append(&profReads);
+    profWrites.init("srcWr", "Writes issued, per source", numSources); s->append(&profWrites);
+    profReadQueueLat.init("srcRdQLat", "Memory cycles reads spent queued, per source", numSources); s->append(&profReadQueueLat);
+    profWritesAhead.init("srcWrAhead", "Writes issued while reads were queued, per source", numSources); s->append(&profWritesAhead);
+
+    // Estimated slowdown of each source's reads due to queueing, x100: (unloaded + queueing latency)/unloaded
+    auto slowdownLambda = [this](uint32_t src) {
+        uint64_t reads = profReads.count(src);
+        if (!reads) return (uint64_t)100;
+        return 100*(reads*baseLatency + profReadQueueLat.count(src))/(reads*baseLatency);
+    };
+    auto slowdownStat = makeLambdaVectorStat(slowdownLambda, numSources);
+    slowdownStat->init("srcSlowdown", "Estimated read slowdown due to queueing, per source (x100)");
+    s->append(slowdownStat);
+
+    initPolicyStats(s);
+    parentStat->append(s);
+}
+
+void MemSchedPolicy::arrive(MemSchedInfo& r, uint64_t cycle) {
+    assert(r.srcId < numSources && r.bank < numBanks);
+    r.seq = nextSeq++;
+    r.arrivalCycle = cycle;
+    r.writesAtArrival = writesIssued;
+    r.marked = false;
+}
+
+void MemSchedPolicy::issue(const MemSchedInfo& r, bool write, uint64_t cycle) {
+    if (write) {
+        writesIssued++;
+        profWrites.inc(r.srcId);
+    } else {
+        profReads.inc(r.srcId);
+        profReadQueueLat.inc(r.srcId, cycle - r.arrivalCycle);
+        profWritesAhead.inc(r.srcId, writesIssued - r.writesAtArrival);
+    }
+    onIssue(r, write, cycle);
+}
+
+void MemSchedPolicy::rankSources(const g_vector<uint64_t>& keys, g_vector<uint32_t>& rank) {
+    g_vector<uint32_t>& order = rankOrder;
+    order.resize(numSources);
+    for (uint32_t s = 0; s < numSources; s++) order[s] = s;
+    std::stable_sort(order.begin(), order.end(), [&keys](uint32_t a, uint32_t b) {return keys[a] < keys[b];});
+    for (uint32_t r = 0; r < numSources; r++) rank[order[r]] = r;
+}
+
+/* FR-FCFS with a cap on consecutive row hits */
+
+class FRFCFSPolicy : public MemSchedPolicy {
+    public:
+        FRFCFSPolicy(uint32_t _numSources, uint32_t _numBanks, uint32_t _rowHitCap, uint32_t _baseLatency)
+            : MemSchedPolicy(_numSources, _numBanks, _rowHitCap, _baseLatency) {}
+
+        const char* getName() const {return "FRFCFS";}
+        bool isFRFCFS() const {return true;}
+
+        bool before(const MemSchedInfo& a, bool aHit, const MemSchedInfo& b, bool bHit) const {
+            if (aHit != bHit) return aHit;
+            return a.seq < b.seq;
+        }
+};
+
+/* PAR-BS */
+
+class PARBSPolicy : public MemSchedPolicy {
+    private:
+        static const uint32_t MARKING_CAP = 5;  // marked requests per source and bank, as in the paper
+
+        uint32_t marked;  // marked requests not issued yet
+        g_vector<uint32_t> batchLoad;  // numSources x numBanks, only used while forming a batch
+        g_vector<uint64_t> jobSize;  // per source
+        g_vector<uint32_t> rank;  // per source, lower goes first
+        Counter profBatches;
+
+    public:
+        PARBSPolicy(uint32_t _numSources, uint32_t _numBanks, uint32_t _rowHitCap, uint32_t _baseLatency)
+            : MemSchedPolicy(_numSources, _numBanks, _rowHitCap, _baseLatency), marked(0)
+        {
+            batchLoad.resize(numSources*numBanks, 0);
+            jobSize.resize(numSources, 0);
+            rank.resize(numSources, 0);
+        }
+
+        const char* getName() const {return "PARBS";}
+
+        bool needsBatch() const {return marked == 0;}
+
+        void mark(MemSchedInfo& r) {
+            uint32_t& load = batchLoad[r.srcId*numBanks + r.bank];
+            if (load < MARKING_CAP) {
+                load++;
+                r.marked = true;
+                marked++;
+            }
+        }
+
+        void endBatch() {
+            if (!marked) return;  // nothing queued
+            profBatches.inc();
+            // Shortest job first: rank by max per-bank load, then by total load
+            for (uint32_t s = 0; s < numSources; s++) {
+                uint32_t maxLoad = 0, totalLoad = 0;
+                for (uint32_t b = 0; b < numBanks; b++) {
+                    uint32_t& load = batchLoad[s*numBanks + b];
+                    maxLoad = MAX(maxLoad, load);
+                    totalLoad += load;
+                    load = 0;
+                }
+                jobSize[s] = (((uint64_t)maxLoad) << 32) | totalLoad;
+            }
+            rankSources(jobSize, rank);
+        }
+
+        bool before(const MemSchedInfo& a, bool aHit, const MemSchedInfo& b, bool bHit) const {
+            if (a.marked != b.marked) return a.marked;
+            if (aHit != bHit) return aHit;
+            if (a.marked && rank[a.srcId] != rank[b.srcId]) return rank[a.srcId] < rank[b.srcId];
+            return a.seq < b.seq;
+        }
+
+    protected:
+        void initPolicyStats(AggregateStat* s) {
+            profBatches.init("batches", "PAR-BS batches formed"); s->append(&profBatches);
+        }
+
+        void onIssue(const MemSchedInfo& r, bool write, uint64_t cycle) {
+            if (r.marked) {
+                assert(marked);
+                marked--;
+            }
+        }
+};
+
+/* ATLAS */
+
+class ATLASPolicy : public MemSchedPolicy {
+    private:
+        static const uint64_t QUANTUM = 10000000;  // in memory cycles, as in the paper
+        static const uint64_t STARVATION_THRESHOLD = 100000;
+
+        uint64_t now;
+        uint64_t quantumEnd;
+        g_vector<uint64_t> service;  // this quantum
+        g_vector<uint64_t> totalService;  // decayed, x8 fixed point
+        g_vector<uint32_t> rank;  // per source, lower goes first
+        Counter profQuanta;
+
+    public:
+        ATLASPolicy(uint32_t _numSources, uint32_t _numBanks, uint32_t _rowHitCap, uint32_t _baseLatency)
+            : MemSchedPolicy(_numSources, _numBanks, _rowHitCap, _baseLatency), now(0), quantumEnd(QUANTUM)
+        {
+            service.resize(numSources, 0);
+            totalService.resize(numSources, 0);
+            rank.resize(numSources, 0);
+        }
+
+        const char* getName() const {return "ATLAS";}
+
+        void beginSelection(uint64_t cycle) {
+            now = cycle;
+            if (cycle < quantumEnd) return;
+            // New quantum: decay with alpha = 7/8, then rank by least attained service
+            profQuanta.inc();
+            for (uint32_t s = 0; s < numSources; s++) {
+                totalService[s] = (7*totalService[s] + 8*service[s])/8;
+                service[s] = 0;
+            }
+            rankSources(totalService, rank);
+            quantumEnd = cycle + QUANTUM;
+        }
+
+        bool before(const MemSchedInfo& a, bool aHit, const MemSchedInfo& b, bool bHit) const {
+            bool aStarved = now - a.arrivalCycle > STARVATION_THRESHOLD;
+            bool bStarved = now - b.arrivalCycle > STARVATION_THRESHOLD;
+            if (aStarved != bStarved) return aStarved;
+            if (rank[a.srcId] != rank[b.srcId]) return rank[a.srcId] < rank[b.srcId];
+            if (aHit != bHit) return aHit;
+            return a.seq < b.seq;
+        }
+
+    protected:
+        void initPolicyStats(AggregateStat* s) {
+            profQuanta.init("quanta", "ATLAS ranking quanta"); s->append(&profQuanta);
+        }
+
+        void onIssue(const MemSchedInfo& r, bool write, uint64_t cycle) {
+            service[r.srcId]++;
+        }
+};
+
+/* BLISS */
+
+class BLISSPolicy : public MemSchedPolicy {
+    private:
+        static const uint32_t BLACKLIST_STREAK = 4;  // as in the paper
+        static const uint64_t CLEARING_INTERVAL = 10000;
+
+        uint32_t lastSrc;
+        uint32_t streak;
+        uint64_t nextClear;
+        g_vector<bool> blacklisted;
+        Counter profBlacklistings;
+
+    public:
+        BLISSPolicy(uint32_t _numSources, uint32_t _numBanks, uint32_t _rowHitCap, uint32_t _baseLatency)
+            : MemSchedPolicy(_numSources, _numBanks, _rowHitCap, _baseLatency), lastSrc(-1u), streak(0), nextClear(CLEARING_INTERVAL)
+        {
+            blacklisted.resize(numSources, false);
+        }
+
+        const char* getName() const {return "BLISS";}
+
+        void beginSelection(uint64_t cycle) {
+            if (cycle < nextClear) return;
+            for (uint32_t s = 0; s < numSources; s++) blacklisted[s] = false;
+            nextClear = cycle + CLEARING_INTERVAL;
+        }
+
+        bool before(const MemSchedInfo& a, bool aHit, const MemSchedInfo& b, bool bHit) const {
+            if (blacklisted[a.srcId] != blacklisted[b.srcId]) return !blacklisted[a.srcId];
+            if (aHit != bHit) return aHit;
+            return a.seq < b.seq;
+        }
+
+    protected:
+        void initPolicyStats(AggregateStat* s) {
+            profBlacklistings.init("blacklistings", "BLISS source blacklistings"); s->append(&profBlacklistings);
+        }
+
+        void onIssue(const MemSchedInfo& r, bool write, uint64_t cycle) {
+            if (r.srcId == lastSrc) {
+                streak++;
+            } else {
+                lastSrc = r.srcId;
+                streak = 1;
+            }
+            if (streak > BLACKLIST_STREAK && !blacklisted[r.srcId]) {
+                blacklisted[r.srcId] = true;
+                profBlacklistings.inc();
+            }
+        }
+};
+
+MemSchedPolicy* CreateMemSchedPolicy(const char* type, uint32_t numSources, uint32_t numBanks, uint32_t rowHitCap, uint32_t baseLatency) {
+    if (strcmp(type, "FRFCFS") == 0) {
+        return new FRFCFSPolicy(numSources, numBanks, rowHitCap, baseLatency);
+    } else if (strcmp(type, "PARBS") == 0) {
+        return new PARBSPolicy(numSources, numBanks, rowHitCap, baseLatency);
+    } else if (strcmp(type, "ATLAS") == 0) {
+        return new ATLASPolicy(numSources, numBanks, rowHitCap, baseLatency);
+    } else if (strcmp(type, "BLISS") == 0) {
+        return new BLISSPolicy(numSources, numBanks, rowHitCap, baseLatency);
+    } else {
+        panic("Invalid memory scheduler %s (options: FRFCFS, PARBS, ATLAS, BLISS)", type);
+    }
+}
@@ -0,0 +1,117 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEM_SCHED_H_
+#define MEM_SCHED_H_
+
+#include <stdint.h>
+#include "g_std/g_vector.h"
+#include "galloc.h"
+#include "stats.h"
+
+/* DRAM request scheduling policies, shared by the DDR and Detailed memory controllers.
+ *
+ * Controllers own their queues and timing model. They tag every queued request with a
+ * MemSchedInfo, and when they pick the next request to issue, they ask the policy to order the
+ * candidates, telling it whether each would hit in its bank's open row. Policies:
+ *  - FRFCFS: row hits first, up to rowHitCap consecutive hits per bank, then oldest first.
+ *  - PARBS: parallelism-aware batch scheduling (Mutlu and Moscibroda, ISCA'08). When a batch
+ *    drains, queued reads are marked, at most MARKING_CAP per source and bank. Marked requests go
+ *    first, then row hits, then sources with the least marked work (shortest job first), then oldest.
+ *  - ATLAS: least-attained-service ranking (Kim et al., HPCA'10). Each quantum, sources are ranked
+ *    by the service they got (with exponential decay); requests that waited beyond a starvation
+ *    threshold go first, then higher-ranked sources, then row hits, then oldest.
+ *  - BLISS: blacklisting (Subramanian et al., ICCD'14). A source that gets more than
+ *    BLACKLIST_STREAK requests served back-to-back is blacklisted until the next clearing
+ *    interval. Non-blacklisted requests go first, then row hits, then oldest.
+ * Writes are scheduled with the same policy, tagged with the source that caused the writeback.
+ *
+ * The policy also keeps per-source stats, so we can see which sources the scheduler slows down
+ * (e.g., whether writeback storms at barriers starve demand reads). All cycles are memory cycles.
+ */
+
+struct MemSchedInfo {
+    uint64_t seq;  // arrival order
+    uint64_t arrivalCycle;
+    uint64_t writesAtArrival;  // writes issued by the controller before this request arrived
+    uint32_t srcId;
+    uint32_t bank;  // flat bank index, rank*banksPerRank + bank
+    bool marked;  // in the current PAR-BS batch
+};
+
+class MemSchedPolicy : public GlobAlloc {
+    protected:
+        const uint32_t numSources;
+        const uint32_t numBanks;
+        const uint32_t rowHitCap;
+        const uint32_t baseLatency;  // unloaded read latency, only used to report slowdowns
+        uint64_t nextSeq;
+        uint64_t writesIssued;
+
+        VectorCounter profReads, profWrites, profReadQueueLat, profWritesAhead;
+
+    private:
+        g_vector<uint32_t> rankOrder;
+
+    public:
+        MemSchedPolicy(uint32_t _numSources, uint32_t _numBanks, uint32_t _rowHitCap, uint32_t _baseLatency);
+        virtual ~MemSchedPolicy() {}
+
+        virtual const char* getName() const = 0;
+        void initStats(AggregateStat* parentStat, const char* statName = "sched");
+
+        // Request lifetime. srcId and bank must be set before arrive()
+        void arrive(MemSchedInfo& r, uint64_t cycle);
+        void issue(const MemSchedInfo& r, bool write, uint64_t cycle);
+
+        // Selection. Controllers call beginSelection() before ordering candidates with before().
+        // Batching policies may ask for a new batch; controllers then call mark() on each
+        // queued read, oldest first, and endBatch().
+        virtual void beginSelection(uint64_t cycle) {}
+        virtual bool needsBatch() const {return false;}
+        virtual void mark(MemSchedInfo& r) {}
+        virtual void endBatch() {}
+
+        // Row hits stop being prioritized after this many consecutive hits to the same bank
+        inline bool prioritizeHit(uint32_t bankRowHits) const {return bankRowHits < rowHitCap;}
+
+        // True if a should issue before b. aHit/bHit: a/b hit in their bank's open row, and prioritizeHit() holds
+        virtual bool before(const MemSchedInfo& a, bool aHit, const MemSchedInfo& b, bool bHit) const = 0;
+
+        // True for plain FR-FCFS, which controllers may implement with specialized queue orders
+        virtual bool isFRFCFS() const {return false;}
+
+    protected:
+        virtual void initPolicyStats(AggregateStat* s) {}
+        virtual void onIssue(const MemSchedInfo& r, bool write, uint64_t cycle) {}
+
+        // rank[s] = position of source s in ascending key order (ties go to lower ids)
+        void rankSources(const g_vector<uint64_t>& keys, g_vector<uint32_t>& rank);
+};
+
+// type is FRFCFS, PARBS, ATLAS or BLISS
+MemSchedPolicy* CreateMemSchedPolicy(const char* type, uint32_t numSources, uint32_t numBanks, uint32_t rowHitCap, uint32_t baseLatency);
+
+#endif  // MEM_SCHED_H_
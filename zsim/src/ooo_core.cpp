@@ -64,6 +64,7 @@ OOOCore::OOOCore(FilterCache* _l1i, FilterCache* _l1d, g_string& _name) : Core(_
         regScoreboard[i] = 0;
     }
     prevBbl = nullptr;
+    resetBblProgress();
 
     lastStoreCommitCycle = 0;
     lastStoreAddrCommitCycle = 0;
@@ -124,7 +125,7 @@ void OOOCore::contextSwitch(int32_t gid) {
         // Do not execute previous BBL, as we were context-switched
         prevBbl = nullptr;
 
-        // Invalidate virtually-addressed filter caches
+        // Filter caches are tagged with the address space, so this keeps their contents
         l1i->contextSwitch();
         l1d->contextSwitch();
     }
@@ -155,30 +156,30 @@ void OOOCore::branch(Address pc, bool taken, Address takenNpc, Address notTakenN
     branchNotTakenNpc = notTakenNpc;
 }
 
-inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
-    if (!prevBbl) {
-        // This is the 1st BBL since scheduled, nothing to simulate
-        prevBbl = bblInfo;
-        // Kill lingering ops from previous BBL
-        loads = stores = 0;
-        return;
-    }
-
-    /* Simulate execution of previous BBL */
-
-    uint32_t bblInstrs = prevBbl->instrs;
-    DynBbl* bbl = &(prevBbl->oooBbl[0]);
-    prevBbl = bblInfo;
+inline void OOOCore::resetBblProgress() {
+    bblUop = 0;
+    bblLoadIdx = bblStoreIdx = 0;
+    bblPrevDecCycle = 0;
+    bblLastCommitCycle = 0;
+}
 
-    uint32_t loadIdx = 0;
-    uint32_t storeIdx = 0;
+/* Simulates the uops of bbl that haven't been simulated yet. With partial, stops at the first load
+ * or store whose address has not been recorded, i.e., one after the current instruction; the rest
+ * is simulated when the next BBL starts.
+ */
+template <bool partial>
+inline void OOOCore::simulateUops(DynBbl* bbl) {
+    uint32_t loadIdx = bblLoadIdx;
+    uint32_t storeIdx = bblStoreIdx;
 
-    uint32_t prevDecCycle = 0;
-    uint64_t lastCommitCycle = 0;  // used to find misprediction penalty
+    uint32_t prevDecCycle = bblPrevDecCycle;
+    uint64_t lastCommitCycle = bblLastCommitCycle;  // used to find misprediction penalty
 
     // Run dispatch/IW
-    for (uint32_t i = 0; i < bbl->uops; i++) {
+    uint32_t i;
+    for (i = bblUop; i < bbl->uops; i++) {
         DynUop* uop = &(bbl->uop[i]);
+        if (partial && ((uop->type == UOP_LOAD && loadIdx == loads) || (uop->type == UOP_STORE && storeIdx == stores))) break;
 
         // Decode stalls
         uint32_t decDiff = uop->decCycle - prevDecCycle;
@@ -344,6 +345,32 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
         //info("0x%lx %3d [%3d %3d] -> [%3d %3d]  %8ld %8ld %8ld %8ld", bbl->addr, i, uop->rs[0], uop->rs[1], uop->rd[0], uop->rd[1], decCycle, c3, dispatchCycle, commitCycle);
     }
 
+    bblUop = i;
+    bblLoadIdx = loadIdx;
+    bblStoreIdx = storeIdx;
+    bblPrevDecCycle = prevDecCycle;
+    bblLastCommitCycle = lastCommitCycle;
+}
+
+inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
+    if (!prevBbl) {
+        // This is the 1st BBL since scheduled, nothing to simulate
+        prevBbl = bblInfo;
+        // Kill lingering ops from previous BBL
+        loads = stores = 0;
+        resetBblProgress();
+        return;
+    }
+
+    /* Simulate execution of previous BBL (or what's left of it, see phaseBarrier()) */
+
+    uint32_t bblInstrs = prevBbl->instrs;
+    DynBbl* bbl = &(prevBbl->oooBbl[0]);
+    prevBbl = bblInfo;
+
+    simulateUops<false>(bbl);
+    uint64_t lastCommitCycle = bblLastCommitCycle;
+
     instrs += bblInstrs;
     uops += bbl->uops;
     bbls++;
@@ -355,9 +382,10 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
 
     // Check full match between expected and actual mem ops
     // If these assertions fail, most likely, something's off in the decoder
-    assert_msg(loadIdx == loads, "%s: loadIdx(%d) != loads (%d)", name.c_str(), loadIdx, loads);
-    assert_msg(storeIdx == stores, "%s: storeIdx(%d) != stores (%d)", name.c_str(), storeIdx, stores);
+    assert_msg(bblLoadIdx == loads, "%s: loadIdx(%d) != loads (%d)", name.c_str(), bblLoadIdx, loads);
+    assert_msg(bblStoreIdx == stores, "%s: storeIdx(%d) != stores (%d)", name.c_str(), bblStoreIdx, stores);
     loads = stores = 0;
+    resetBblProgress();
 
 
     /* Simulate frontend for branch pred + fetch of this BBL
@@ -457,6 +485,18 @@ void OOOCore::leave() {
     cRec.notifyLeave(curCycle);
 }
 
+void OOOCore::phaseBarrier() {
+    // Our BBL is only simulated when the next one starts, so its loads and stores before the magic op
+    // haven't reached the caches yet. They belong to the phase we're ending, so simulate them first.
+    if (prevBbl) simulateUops<true>(&(prevBbl->oooBbl[0]));
+
+    // The barrier acts as a full fence: it waits for outstanding stores, and nothing issues until it completes
+    uint64_t startCycle = MAX(curCycle, lastStoreCommitCycle);
+    uint64_t doneCycle = l1d->barrier(startCycle);
+    cRec.record(curCycle, startCycle, doneCycle);
+    if (doneCycle > curCycle) advance(doneCycle);
+}
+
 void OOOCore::cSimStart() {
     uint64_t targetCycle = cRec.cSimStart(curCycle);
     assert(targetCycle >= curCycle);
@@ -371,6 +371,12 @@ class OOOCore : public Core {
 
         BblInfo* prevBbl;
 
+        //Progress through prevBbl, which may be simulated in two parts (see phaseBarrier())
+        uint32_t bblUop;
+        uint32_t bblLoadIdx, bblStoreIdx;
+        uint32_t bblPrevDecCycle;
+        uint64_t bblLastCommitCycle;
+
         //Record load and store addresses
         Address loadAddrs[256];
         Address storeAddrs[256];
@@ -447,6 +453,7 @@ class OOOCore : public Core {
 
         virtual void join();
         virtual void leave();
+        virtual void phaseBarrier();
 
         InstrFuncPtrs GetFuncPtrs();
 
@@ -476,6 +483,8 @@ class OOOCore : public Core {
         inline void branch(Address pc, bool taken, Address takenNpc, Address notTakenNpc);
 
         inline void bbl(Address bblAddr, BblInfo* bblInfo);
+        inline void resetBblProgress();
+        template <bool partial> inline void simulateUops(DynBbl* bbl);
 
         static void LoadFunc(THREADID tid, ADDRINT addr);
         static void StoreFunc(THREADID tid, ADDRINT addr);
@@ -26,6 +26,7 @@
 #include "phase_concurrent_coherence_ctrls.h"
 #include "cache.h"
 #include "network.h"
+#include "zsim.h"
 
 /* Do a simple XOR block hash on address to determine its bank. Hacky for now,
  * should probably have a class that deals with this with a real hash function
@@ -89,6 +90,7 @@ uint64_t DCWSOLIBottomCC::processEviction(Address wbLineAddr, uint32_t lineId, b
         default: panic("!?");
     }
     assert_msg(*state == I, "Wrong final state %s on eviction", DCWSOLIStateName(*state));
+    updateBarrierIndex(lineId);
     return respCycle;
 }
 
@@ -121,6 +123,8 @@ uint64_t DCWSOLIBottomCC::processAccess(Address lineAddr, uint32_t lineId, Acces
                 profGETSMiss.inc();
                 assert(*state == C || *state == S);
             } else {
+                //An Old line refreshed by a read is valid again, and survives the next barrier
+                if (*state == O) *state = S;
                 profGETSHit.inc();
             }
             break;
@@ -155,6 +159,7 @@ uint64_t DCWSOLIBottomCC::processAccess(Address lineAddr, uint32_t lineId, Acces
         default: panic("!?");
     }
     assert_msg(respCycle >= cycle, "XXX %ld %ld", respCycle, cycle);
+    updateBarrierIndex(lineId);
     return respCycle;
 }
 
@@ -165,6 +170,7 @@ void DCWSOLIBottomCC::processWritebackOnAccess(Address lineAddr, uint32_t lineId
         //Silent transition to M if in E
         *state = D;
     }
+    updateBarrierIndex(lineId);
 }
 
 void DCWSOLIBottomCC::processInval(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback) {
@@ -215,9 +221,58 @@ void DCWSOLIBottomCC::processInval(Address lineAddr, uint32_t lineId, InvType ty
             break;
         default: panic("!?");
     }
+    updateBarrierIndex(lineId);
     //NOTE: BottomCC never calls up on an invalidate, so it adds no extra latency
 }
 
+/* Self-downgrade at a phase barrier. Unlike a BAR invalidate, this is initiated by the
+ * cache itself, so it has to tell the upper level about the transition:
+ *  - D->C sends a Cl, i.e. a PUTX_KEEPEXCL writeback
+ *  - W->O sends a Sh, i.e. a PUTX_SHARE writeback
+ *  - O/L->I sends a PUTS so the directory drops us from its sharer set
+ *  - S->O is silent
+ * The caller must hold ccLock, as in processEviction.
+ */
+uint64_t DCWSOLIBottomCC::processBarrier(Address lineAddr, int32_t lineId, uint64_t cycle, uint32_t srcId) {
+    DCWSOLIState* state = &array[lineId];
+    uint64_t respCycle = cycle;
+    switch (*state) {
+        case D:
+        case W:
+            {
+                bool isWinner = (*state == W);
+                uint32_t flags = isWinner? MemReq::PUTX_SHARE : MemReq::PUTX_KEEPEXCL;
+                uint32_t parentId = getParentId(lineAddr);
+                MemReq req = {lineAddr, PUTX, selfId, state, cycle, &ccLock, *state, srcId, flags};
+                respCycle = parents[parentId]->access(req) + parentRTTs[parentId];
+                if (isWinner) profBARSh.inc();
+                else profBARCl.inc();
+            }
+            //An upper-level invalidate may have raced with us while ccLock was released
+            assert_msg(*state == C || *state == O || *state == I, "Wrong final state %s on barrier writeback", DCWSOLIStateName(*state));
+            break;
+        case S:
+            *state = O;
+            break;
+        case O:
+        case L:
+            {
+                uint32_t parentId = getParentId(lineAddr);
+                MemReq req = {lineAddr, PUTS, selfId, state, cycle, &ccLock, *state, srcId, 0 /*no flags*/};
+                respCycle = parents[parentId]->access(req) + parentRTTs[parentId];
+                profBARInv.inc();
+            }
+            assert_msg(*state == I, "Wrong final state %s on barrier self-invalidation", DCWSOLIStateName(*state));
+            break;
+        case C:
+        case I:
+            break; //Nothing to do
+        default: panic("!?");
+    }
+    updateBarrierIndex(lineId);
+    return respCycle;
+}
+
 
 uint64_t DCWSOLIBottomCC::processNonInclusiveWriteback(Address lineAddr, AccessType type, uint64_t cycle, DCWSOLIState* state, uint32_t srcId, uint32_t flags) {
     if (!nonInclusiveHack) panic("Non-inclusive %s on line 0x%lx, this cache should be inclusive", AccessTypeName(type), lineAddr);
@@ -232,8 +287,11 @@ uint64_t DCWSOLIBottomCC::processNonInclusiveWriteback(Address lineAddr, AccessT
 /* MESITopCC implementation */
 
 void DCWSOLITopCC::init(const g_vector<BaseCache*>& _children, Network* network, const char* name) {
-    if (_children.size() > MAX_CACHE_CHILDREN) {
-        panic("[%s] Children size (%d) > MAX_CACHE_CHILDREN (%d)", name, (uint32_t)_children.size(), MAX_CACHE_CHILDREN);
+    if (_children.size() > MAX_CACHE_CHILDREN && fmt.getType() == SharerFormat::FULL_MAP) {
+        //Track clusters of children instead of growing the bit-vector without bound
+        if (nonInclusiveHack) panic("[%s] %ld children need a clustered directory, which can't use nonInclusiveHack", name, _children.size());
+        info("[%s] %ld children > MAX_CACHE_CHILDREN (%d), using a clustered directory", name, _children.size(), MAX_CACHE_CHILDREN);
+        fmt = SharerFormat(SharerFormat::CLUSTERED, 1, MAX_CACHE_CHILDREN);
     }
     children.resize(_children.size());
     childrenRTTs.resize(_children.size());
@@ -241,9 +299,29 @@ void DCWSOLITopCC::init(const g_vector<BaseCache*>& _children, Network* network,
         children[c] = _children[c];
         childrenRTTs[c] = (network)? network->getRTT(name, children[c]->getName()) : 0;
     }
+
+    fmt.init(children.size(), name);
+    sharerBits = gm_calloc<uint64_t>((size_t)numLines*fmt.wordsPerEntry());
+    info("[%s] %s directory, %ld children, %d sharer bits/entry, %d children/group", name, fmt.name(), children.size(), fmt.bitsPerEntry(), fmt.childrenPerGroup());
+}
+
+bool DCWSOLITopCC::hasWinner(Entry* e) {
+    if (e->winner != NO_WINNER && (uint32_t)zinfo->coreBarriers[e->exclCore] != e->winnerEpoch) {
+        e->winner = NO_WINNER; //the winner's phase is over
+    }
+    return e->winner != NO_WINNER;
 }
 
-uint64_t DCWSOLITopCC::sendInvalidates(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId) {
+void DCWSOLITopCC::setWinner(Entry* e, uint32_t childId) {
+    e->winner = childId;
+    e->winnerEpoch = zinfo->coreBarriers[e->exclCore];
+}
+
+/* Sends INV/INVX to every sharer of the line, except skipChildId. If the sharer set is coarse, this also hits
+ * non-sharers in the same groups, which ack without doing anything (InvReq::mayMiss).
+ */
+uint64_t DCWSOLITopCC::sendInvalidates(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId,
+        uint32_t skipChildId) {
     //Send down downgrades/invalidates
     Entry* e = &array[lineId];
 
@@ -254,36 +332,69 @@ uint64_t DCWSOLITopCC::sendInvalidates(Address lineAddr, uint32_t lineId, InvTyp
 
     uint64_t maxCycle = cycle; //keep maximum cycle only, we assume all invals are sent in parallel
     if (!e->isEmpty()) {
-        uint32_t numChildren = children.size();
         uint32_t sentInvs = 0;
-        for (uint32_t c = 0; c < numChildren; c++) {
-            if (e->sharers[c]) {
-                InvReq req = {lineAddr, type, reqWriteback, cycle, srcId};
-                uint64_t respCycle = children[c]->invalidate(req);
-                respCycle += childrenRTTs[c];
-                maxCycle = MAX(respCycle, maxCycle);
-                if (type == INV) e->sharers[c] = false;
-                sentInvs++;
-            }
+        uint32_t lastInv = 0;
+        bool coarse = e->coarse;
+        bool childWb = false; //INVX only: tells C->S (writes back) from D->W (keeps the data)
+        bool* wb = (type == INVX)? &childWb : reqWriteback;
+        fmt.forEach(sharers(lineId), coarse, e->numSharers, [&](uint32_t c) {
+            if (c == skipChildId) return;
+            InvReq req = {lineAddr, type, wb, cycle, srcId, coarse};
+            uint64_t respCycle = children[c]->invalidate(req);
+            respCycle += childrenRTTs[c];
+            maxCycle = MAX(respCycle, maxCycle);
+            lastInv = c;
+            sentInvs++;
+        });
+        if (coarse) {
+            assert(type == INV); //INVX only goes to exclusive lines, which have a single sharer
+            assert(sentInvs >= e->numSharers);
+            profMulticasts.inc();
+            profSpuriousInvs.inc(sentInvs - e->numSharers);
+        } else {
+            assert(sentInvs == e->numSharers);
         }
-        assert(sentInvs == e->numSharers);
         if (type == INV) {
+            e->winner = NO_WINNER; //whoever held write permission lost it
             e->numSharers = 0;
+            fmt.clear(sharers(lineId), &e->coarse);
         } else {
             //TODO: This is kludgy -- once the sharers format is more sophisticated, handle downgrades with a different codepath
             assert(e->exclusive);
             assert(e->numSharers == 1);
             e->exclusive = false;
+            if (childWb) {
+                *reqWriteback = true; //C->S, nothing was written
+            } else if (!hasWinner(e)) {
+                //D->W: a silent C->D write made the sharer a winner, which keeps its data until its barrier
+                setWinner(e, lastInv);
+            }
         }
     }
     return maxCycle;
 }
 
+/* Tells the winner of a write race that someone else tried to write the line (D->W, or C->S if it
+ * had not written yet). Sent once, on the first loss; the winner keeps its data until the next barrier.
+ */
+uint64_t DCWSOLITopCC::sendContention(Address lineAddr, uint32_t lineId, uint64_t cycle, uint32_t srcId) {
+    Entry* e = &array[lineId];
+    uint32_t w = e->winner;
+    assert(w != NO_WINNER && mayShare(lineId, w));
+    bool winnerWb = false; //nothing to pull up, the winner keeps the line
+    InvReq req = {lineAddr, INVX, &winnerWb, cycle, srcId};
+    uint64_t respCycle = children[w]->invalidate(req) + childrenRTTs[w];
+    e->exclusive = false;
+    profContention.inc();
+    return respCycle;
+}
+
 
 uint64_t DCWSOLITopCC::processEviction(Address wbLineAddr, uint32_t lineId, bool* reqWriteback, uint64_t cycle, uint32_t srcId) {
     if (nonInclusiveHack) {
         // Don't invalidate anything, just clear our entry
         array[lineId].clear();
+        fmt.clear(sharers(lineId), &array[lineId].coarse);
         return cycle;
     } else {
         //Send down invalidates
@@ -297,36 +408,42 @@ uint64_t DCWSOLITopCC::processAccess(Address lineAddr, uint32_t lineId, AccessTy
     uint64_t respCycle = cycle;
     switch (type) {
         case PUTX:
-            assert(e->isExclusive());
+            if ((flags & (MemReq::PUTX_SHARE | MemReq::PUTX_KEEPEXCL)) && *childState == W) {
+                //Barrier on a winner (W->O): the data is now visible, and nobody holds the line exclusively anymore.
+                //Also covers a D->C barrier that raced with a contention downgrade (D->W).
+                assert(mayShare(lineId, childId));
+                e->exclusive = false;
+                e->winner = NO_WINNER; //the race ends with the phase
+                *childState = O;
+                break; //don't remove from sharer set
+            }
+            assert(e->isExclusive() || e->winner == childId); //a contended winner (W) is not exclusive anymore
             if (flags & MemReq::PUTX_KEEPEXCL) {
-                assert(e->sharers[childId]);
-                assert(*childState == D);// || *childState == W);
-//                *childState = E; //they don't hold dirty data anymore
-//                if (*childState == D){
-                    *childState = C;
-//                }else if (*childState == W){
-//                    *childState = S;
-//                }
-
+                assert(mayShare(lineId, childId));
+                assert(*childState == D);
+                *childState = C; //they don't hold dirty data anymore
+                if (e->winner == childId) e->winner = NO_WINNER; //the race ends with the phase
                 break; //don't remove from sharer set. It'll keep exclusive perms.
             }
             //note NO break in general
         case PUTS:
-            assert(e->sharers[childId]);
-            e->sharers[childId] = false;
-            e->numSharers--;
+            assert(mayShare(lineId, childId));
+            removeSharer(lineId, childId);
+            if (e->winner == childId) e->winner = NO_WINNER;
             *childState = I;
             break;
         case GETS:
             if (e->isEmpty() && haveExclusive && !(flags & MemReq::NOEXCL)) {
-                //Give in E state
+                //Give in E state. This doesn't make the child a winner: if it never writes, it must not
+                //make other writers lose. If it writes silently (C->D), a downgrade finds it in W.
+                assert(srcId < zinfo->numCores);
                 e->exclusive = true;
-                e->sharers[childId] = true;
-                e->numSharers = 1;
+                e->exclCore = srcId;
+                addSharer(lineId, childId);
                 *childState = C;
             } else {
                 //Give in S state
-                assert(e->sharers[childId] == false);
+                assert(!isSharer(lineId, childId, childState));
 
                 if (e->isExclusive()) {
                     //Downgrade the exclusive sharer
@@ -335,78 +452,65 @@ uint64_t DCWSOLITopCC::processAccess(Address lineAddr, uint32_t lineId, AccessTy
 
                 assert_msg(!e->isExclusive(), "Can't have exclusivity here. isExcl=%d excl=%d numSharers=%d", e->isExclusive(), e->exclusive, e->numSharers);
 
-                e->sharers[childId] = true;
-                e->numSharers++;
+                addSharer(lineId, childId);
                 e->exclusive = false; //dsm: Must set, we're explicitly non-exclusive
                 *childState = S;
             }
             break;
         case GETX:
-//TODO This case handles winning and losing. I need to actually write it.
+        {
             assert(haveExclusive); //the current cache better have exclusive access to this line
 
-            if (e->exclusive == true){
-                if (e->winner != childId){
-                    *childState = L;
-                    e->sharers[childId] = true;
-                    e->numSharers++;
-                    if (e->numSharers == 2){
-                        //TODO send contention message to the child - I think I have modified sendInvalidates to do this
-                        respCycle = sendInvalidates(lineAddr, lineId, INVX, inducedWriteback, cycle, srcId);
-                    }
-                }
-            }else{
+            bool raced = hasWinner(e);
+            if (raced && e->winner == childId) {
+                //The winner lost exclusivity this phase (D->W) and writes again
+                assert(mayShare(lineId, childId));
+                assert(!e->exclusive);
+                *childState = W;
+                profWins.inc();
+            } else if (raced) {
+                //Someone else already holds write permission: we lose the race. Losers get no data.
+                if (!isSharer(lineId, childId, childState)) addSharer(lineId, childId);
+                *childState = L;
+                profLosses.inc();
+                //On the first loss, notify the winner. The directory holds the line until the winner acks.
+                if (e->exclusive) respCycle = sendContention(lineAddr, lineId, cycle, srcId);
+            } else {
                 // If child is in sharers list (this is an upgrade miss), take it out
-                if (e->sharers[childId]) {
+                if (isSharer(lineId, childId, childState)) {
                     assert_msg(!e->isExclusive(), "Spurious GETX, childId=%d numSharers=%d isExcl=%d excl=%d", childId, e->numSharers, e->isExclusive(), e->exclusive);
-                    e->sharers[childId] = false;
-                    e->numSharers--;
+                    removeSharer(lineId, childId);
                 }
     
-                // Invalidate all other copies
-                respCycle = sendInvalidates(lineAddr, lineId, INV, inducedWriteback, cycle, srcId);
+                // Invalidate all other copies (a coarse sharer set may still cover the requester, so skip it)
+                respCycle = sendInvalidates(lineAddr, lineId, INV, inducedWriteback, cycle, srcId, childId);
     
                 // Set current sharer, mark exclusive
-                e->sharers[childId] = true;
-                e->numSharers++;
+                addSharer(lineId, childId);
+                assert(srcId < zinfo->numCores);
                 e->exclusive = true;
-    
+                e->exclCore = srcId;
+                setWinner(e, childId);
+
                 assert(e->numSharers == 1);
-    
+
                 *childState = D; //give in M directly
-                    
+                profWins.inc();
             }
 
             break;
+        }
 
         default: panic("!?");
     }
 
-// Check code added to help debug, should be removed
-    uint32_t temp = e->numSharers;
-    for (uint32_t c=0; c<MAX_CACHE_CHILDREN; ++c){
-        if (e->sharers[c]){
-            --temp;
-        }
-    }
-    if (temp > 0){
-        unsigned int marker = 0;
-        switch (type){
-            case PUTX:
-                marker = 1;
-                break;
-            case PUTS:
-                marker = 2;
-                break;
-            case GETX:
-                marker = 3;
-                break;
-            case GETS:
-                marker = 4;
-                break;
-        }
-        panic("sharer tracking failed in processAccess, marker = %u", marker);
-    }
+#ifdef PCC_VERIFY
+    //Sharer tracking check; walks the whole sharer set, so only in verify builds. Coarse sets can't be counted.
+    uint32_t count = 0;
+    fmt.forEach(sharers(lineId), e->coarse, e->numSharers, [&](uint32_t c) {count++;});
+    assert_msg(e->coarse || count == e->numSharers, "Sharer tracking failed on %s, line 0x%lx: %d sharers, numSharers %d",
+            AccessTypeName(type), lineAddr, count, e->numSharers);
+#endif
 
     return respCycle;
 }
@@ -26,20 +26,28 @@
 #ifndef COHERENCE_CTRLS_H_
 #define COHERENCE_CTRLS_H_
 
-#include <bitset>
 #include "constants.h"
 #include "g_std/g_string.h"
 #include "g_std/g_vector.h"
 #include "locks.h"
 #include "phase_concurrent_memory_hierarchy.h"
 #include "pad.h"
+#include "sharer_formats.h"
 #include "stats.h"
 
 //TODO: Now that we have a pure CC interface, the MESI controllers should go on different files.
 
 /* Generic, integrated controller interface */
 class CC : public GlobAlloc {
+    protected:
+        DCWSOLIState* lineStates; //state of each of our lines, indexed by lineId; owned by our bottom CC
+
     public:
+        CC() : lineStates(nullptr) {}
+
+        //Replacement policies read line states directly (contiguous per set), without virtual calls
+        inline const DCWSOLIState* getLineStates() const {return lineStates;}
+
         //Initialization
         virtual void setParents(uint32_t childId, const g_vector<MemObject*>& parents, Network* network) = 0;
         virtual void setChildren(const g_vector<BaseCache*>& children, Network* network) = 0;
@@ -56,6 +64,12 @@ class CC : public GlobAlloc {
         virtual void startInv() = 0;
         virtual uint64_t processInv(const InvReq& req, int32_t lineId, uint64_t startCycle) = 0;
 
+        //Phase barrier methods; see Cache::barrier for call sequence
+        virtual void startBarrier() = 0;
+        virtual void getBarrierLines(g_vector<uint32_t>& lineIds) = 0; //lines that change state at a barrier (i.e., not in C or I)
+        virtual uint64_t processBarrier(Address lineAddr, int32_t lineId, uint64_t startCycle, uint32_t srcId) = 0;
+        virtual void endBarrier() = 0;
+
         //Repl policy interface
         virtual uint32_t numSharers(uint32_t lineId) = 0;
         virtual bool isValid(uint32_t lineId) = 0;
@@ -82,6 +96,7 @@ class Network;
 class DCWSOLIBottomCC : public GlobAlloc {
     private:
         DCWSOLIState* array;
+        g_vector<uint64_t> barrierLines; //bitmap over lineIds in states that change on a barrier (all but C and I)
         g_vector<MemObject*> parents;
         g_vector<uint32_t> parentRTTs;
         uint32_t numLines;
@@ -91,6 +106,7 @@ class DCWSOLIBottomCC : public GlobAlloc {
         Counter profGETSHit, profGETSMiss, profGETXHit, profGETXMissIM /*from invalid*/, profGETXMissSM /*from S, i.e. upgrade misses*/;
         Counter profPUTS, profPUTX /*received from downstream*/;
         Counter profINV, profINVX, profFWD /*received from upstream*/;
+        Counter profBARCl, profBARSh, profBARInv /*phase barrier self-downgrades, sent upstream*/;
         //Counter profWBIncl, profWBCoh /* writebacks due to inclusion or coherence, received from downstream, does not include PUTS */;
         // TODO: Measuring writebacks is messy, do if needed
         Counter profGETNextLevelLat, profGETNetLat;
@@ -102,11 +118,12 @@ class DCWSOLIBottomCC : public GlobAlloc {
         PAD();
 
     public:
-        DCWSOLIBottomCC(uint32_t _numLines, uint32_t _selfId, bool _nonInclusiveHack) : numLines(_numLines), selfId(_selfId), nonInclusiveHack(_nonInclusiveHack) {
-            array = gm_calloc<DCWSOLIState>(numLines);
+        //_array is the state array of our CC, which allocates it before we are built, so replacement policies can get to it
+        DCWSOLIBottomCC(DCWSOLIState* _array, uint32_t _numLines, uint32_t _selfId, bool _nonInclusiveHack) : array(_array), numLines(_numLines), selfId(_selfId), nonInclusiveHack(_nonInclusiveHack) {
             for (uint32_t i = 0; i < numLines; i++) {
                 array[i] = I;
             }
+            barrierLines.resize((numLines + 63)/64, 0);
             futex_init(&ccLock);
         }
 
@@ -128,6 +145,9 @@ class DCWSOLIBottomCC : public GlobAlloc {
             profINV.init("INV", "Invalidates (from upper level)");
             profINVX.init("INVX", "Downgrades (from upper level)");
             profFWD.init("FWD", "Forwards (from upper level)");
+            profBARCl.init("BARCl", "Barrier D->C cleans (writebacks to upper level)");
+            profBARSh.init("BARSh", "Barrier W->O shares (writebacks to upper level)");
+            profBARInv.init("BARInv", "Barrier O/L->I self-invalidations");
             profGETNextLevelLat.init("latGETnl", "GET request latency on next level");
             profGETNetLat.init("latGETnet", "GET request latency on network to next level");
 
@@ -141,6 +161,9 @@ class DCWSOLIBottomCC : public GlobAlloc {
             parentStat->append(&profINV);
             parentStat->append(&profINVX);
             parentStat->append(&profFWD);
+            parentStat->append(&profBARCl);
+            parentStat->append(&profBARSh);
+            parentStat->append(&profBARInv);
             parentStat->append(&profGETNextLevelLat);
             parentStat->append(&profGETNetLat);
         }
@@ -153,6 +176,8 @@ class DCWSOLIBottomCC : public GlobAlloc {
 
         void processInval(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback);
 
+        uint64_t processBarrier(Address lineAddr, int32_t lineId, uint64_t cycle, uint32_t srcId);
+
         uint64_t processNonInclusiveWriteback(Address lineAddr, AccessType type, uint64_t cycle, DCWSOLIState* state, uint32_t srcId, uint32_t flags);
 
         inline void lock() {
@@ -165,35 +190,65 @@ class DCWSOLIBottomCC : public GlobAlloc {
 
         /* Replacement policy query interface */
         inline bool isValid(uint32_t lineId) {
-            return (array[lineId] != L) && (array[lineId] != I);
-            //TODO determine if L should be considered invalid for zsim purposes
+            return IsValidState(array[lineId]);
         }
 
         inline bool isDirty(uint32_t lineId) {
-            return (array[lineId] == D) || (array[lineId] == W);
-            //TODO determine if L or C should be considered dirty for zsim purposes
+            return IsDirtyState(array[lineId]);
+        }
+
+        /* Phase barrier query interface */
+        inline DCWSOLIState getState(uint32_t lineId) {
+            return array[lineId];
+        }
+
+        //Appends the lines that transition on a barrier, in lineId order. Caller must hold ccLock.
+        void getBarrierLines(g_vector<uint32_t>& lineIds) {
+            for (uint32_t w = 0; w < barrierLines.size(); w++) {
+                uint64_t bits = barrierLines[w];
+                while (bits) {
+                    lineIds.push_back(w*64 + __builtin_ctzl(bits));
+                    bits &= bits - 1;
+                }
+            }
         }
 
         //Could extend with isExclusive, isDirty, etc, but not needed for now.
 
     private:
         uint32_t getParentId(Address lineAddr);
+
+        //Must be called after any change to array[lineId], with ccLock held (parents change our state
+        //through MemReq::state, so this is done at the end of every process* method)
+        inline void updateBarrierIndex(uint32_t lineId) {
+            uint64_t bit = 1ul << (lineId % 64);
+            if (array[lineId] == C || array[lineId] == I) barrierLines[lineId/64] &= ~bit;
+            else barrierLines[lineId/64] |= bit;
+        }
 };
 
 
 //Implements the "top" part: Keeps directory information, handles downgrades and invalidates
 class DCWSOLITopCC : public GlobAlloc {
     private:
+        static const uint16_t NO_WINNER = (uint16_t)-1;
+
+        //Sharers themselves are kept in sharerBits, in the format chosen for this cache (see sharer_formats.h)
         struct Entry {
-            uint32_t numSharers;
-            uint32_t winner;
-            std::bitset<MAX_CACHE_CHILDREN> sharers;
+            uint16_t numSharers; //always exact, even if the sharer set is coarse
+            uint16_t winner; //child that holds (or won) write permission this phase, NO_WINNER if none
+            uint16_t exclCore; //core last granted exclusive permission; the winner's phase ends at its barrier
             bool exclusive;
+            bool coarse; //sharer set overflowed to a coarse vector
+            uint32_t winnerEpoch; //exclCore's barrier count when the winner won
 
             void clear() {
                 exclusive = false;
+                coarse = false;
                 numSharers = 0;
-                sharers.reset();
+                winner = NO_WINNER;
+                exclCore = 0;
+                winnerEpoch = 0;
             }
 
             bool isEmpty() {
@@ -206,18 +261,27 @@ class DCWSOLITopCC : public GlobAlloc {
         };
 
         Entry* array;
+        uint64_t* sharerBits; //numLines x fmt.wordsPerEntry()
+        SharerFormat fmt;
         g_vector<BaseCache*> children;
         g_vector<uint32_t> childrenRTTs;
         uint32_t numLines;
 
         bool nonInclusiveHack;
 
+        //Write races
+        Counter profWins, profLosses, profContention;
+        //Coarse sharer sets
+        Counter profOverflows, profMulticasts, profSpuriousInvs;
+
         PAD();
         lock_t ccLock;
         PAD();
 
     public:
-        DCWSOLITopCC(uint32_t _numLines, bool _nonInclusiveHack) : numLines(_numLines), nonInclusiveHack(_nonInclusiveHack) {
+        DCWSOLITopCC(uint32_t _numLines, bool _nonInclusiveHack, const SharerFormat& _fmt) : sharerBits(nullptr), fmt(_fmt),
+            numLines(_numLines), nonInclusiveHack(_nonInclusiveHack)
+        {
             array = gm_calloc<Entry>(numLines);
             for (uint32_t i = 0; i < numLines; i++) {
                 array[i].clear();
@@ -228,6 +292,23 @@ class DCWSOLITopCC : public GlobAlloc {
 
         void init(const g_vector<BaseCache*>& _children, Network* network, const char* name);
 
+        void initStats(AggregateStat* parentStat) {
+            profWins.init("wins", "GETX write races won (write permission granted)");
+            profLosses.init("losses", "GETX write races lost (loser gets L, no data)");
+            profContention.init("contMsgs", "Contention notifications sent to winners");
+
+            profOverflows.init("dirOvf", "Directory entries that overflowed to a coarse sharer set");
+            profMulticasts.init("dirMcast", "Invalidation rounds multicast to groups of children (coarse sharer sets)");
+            profSpuriousInvs.init("dirSpInv", "Invalidates sent to non-sharers due to coarse sharer sets");
+
+            parentStat->append(&profWins);
+            parentStat->append(&profLosses);
+            parentStat->append(&profContention);
+            parentStat->append(&profOverflows);
+            parentStat->append(&profMulticasts);
+            parentStat->append(&profSpuriousInvs);
+        }
+
         uint64_t processEviction(Address wbLineAddr, uint32_t lineId, bool* reqWriteback, uint64_t cycle, uint32_t srcId);
 
         uint64_t processAccess(Address lineAddr, uint32_t lineId, AccessType type, uint32_t childId, bool haveExclusive,
@@ -249,7 +330,43 @@ class DCWSOLITopCC : public GlobAlloc {
         }
 
     private:
-        uint64_t sendInvalidates(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId);
+        inline uint64_t* sharers(uint32_t lineId) {
+            return &sharerBits[lineId*fmt.wordsPerEntry()];
+        }
+
+        //May be a false positive if the entry is coarse; use isSharer for an exact answer
+        inline bool mayShare(uint32_t lineId, uint32_t childId) {
+            Entry* e = &array[lineId];
+            return fmt.contains(sharers(lineId), e->coarse, e->numSharers, childId);
+        }
+
+        //A coarse entry can't tell if the requester shares the line, but the requester's own state can
+        inline bool isSharer(uint32_t lineId, uint32_t childId, const DCWSOLIState* childState) {
+            return array[lineId].coarse? (*childState != I) : mayShare(lineId, childId);
+        }
+
+        inline void addSharer(uint32_t lineId, uint32_t childId) {
+            Entry* e = &array[lineId];
+            if (fmt.add(sharers(lineId), &e->coarse, e->numSharers, childId)) profOverflows.inc();
+            e->numSharers++;
+        }
+
+        inline void removeSharer(uint32_t lineId, uint32_t childId) {
+            Entry* e = &array[lineId];
+            fmt.remove(sharers(lineId), &e->coarse, e->numSharers, childId);
+            e->numSharers--;
+        }
+
+        /* Write races only last a phase. Barriers on clean lines (C->C, S->O) are silent, so the directory
+         * can't clear winners as they happen; instead, a winner is stale once its core has gone through
+         * a barrier since it won (see GlobSimInfo::coreBarriers).
+         */
+        bool hasWinner(Entry* e);
+        void setWinner(Entry* e, uint32_t childId);
+
+        uint64_t sendInvalidates(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId,
+                uint32_t skipChildId = (uint32_t)-1);
+        uint64_t sendContention(Address lineAddr, uint32_t lineId, uint64_t cycle, uint32_t srcId);
 };
 
 static inline bool CheckForDCWSOLIRace(AccessType& type, DCWSOLIState* state, DCWSOLIState initialState) {
@@ -265,13 +382,14 @@ static inline bool CheckForDCWSOLIRace(AccessType& type, DCWSOLIState* state, DC
                 skipAccess = true;
             } else {
                 //We were downgraded (INVX), still need to do the PUT
-                assert(*state == S);
+                assert(*state == S || *state == W);
                 //If we wanted to do a PUTX, just change it to a PUTS b/c now the line is not exclusive anymore
-                if (type == PUTX) type = PUTS;
+                //(a D line downgraded to W still holds the dirty data, so it keeps its PUTX)
+                if (type == PUTX && *state == S) type = PUTS;
             }
         } else if (type == GETX) { //...or it is a GETX
-            //In this case, the line MUST have been in S and have been INValidated
-            assert(initialState == S);
+            //In this case, the line MUST have been in S or O and have been INValidated
+            assert(initialState == S || initialState == O);
             assert(*state == I);
             //Do nothing. This is still a valid GETX, only it is not an upgrade miss anymore
         } else { //no GETSs can race with INVs, if we are doing a GETS it's because the line was invalid to begin with!
@@ -288,26 +406,29 @@ class DCWSOLICC : public CC {
         DCWSOLIBottomCC* bcc;
         uint32_t numLines;
         bool nonInclusiveHack;
+        SharerFormat dirFormat;
         g_string name;
 
     public:
         //Initialization
-        DCWSOLICC(uint32_t _numLines, bool _nonInclusiveHack, g_string& _name) : tcc(nullptr), bcc(nullptr),
-            numLines(_numLines), nonInclusiveHack(_nonInclusiveHack), name(_name) {}
+        DCWSOLICC(uint32_t _numLines, bool _nonInclusiveHack, const SharerFormat& _dirFormat, g_string& _name) : tcc(nullptr), bcc(nullptr),
+            numLines(_numLines), nonInclusiveHack(_nonInclusiveHack), dirFormat(_dirFormat), name(_name) {
+            lineStates = gm_calloc<DCWSOLIState>(numLines);
+        }
 
         void setParents(uint32_t childId, const g_vector<MemObject*>& parents, Network* network) {
-            bcc = new DCWSOLIBottomCC(numLines, childId, nonInclusiveHack);
+            bcc = new DCWSOLIBottomCC(lineStates, numLines, childId, nonInclusiveHack);
             bcc->init(parents, network, name.c_str());
         }
 
         void setChildren(const g_vector<BaseCache*>& children, Network* network) {
-            tcc = new DCWSOLITopCC(numLines, nonInclusiveHack);
+            tcc = new DCWSOLITopCC(numLines, nonInclusiveHack, dirFormat);
             tcc->init(children, network, name.c_str());
         }
 
         void initStats(AggregateStat* cacheStat) {
-            //no tcc stats
             bcc->initStats(cacheStat);
+            tcc->initStats(cacheStat);
         }
 
         //Access methods
@@ -366,7 +487,7 @@ class DCWSOLICC : public CC {
             } else {
                 //Prefetches are side requests and get handled a bit differently
                 bool isPrefetch = req.flags & MemReq::PREFETCH;
-                assert(!isPrefetch || req.type == GETS);
+                assert(!isPrefetch || req.type == GETS); //a GETX prefetch would claim the phase's write race
                 uint32_t flags = req.flags & ~MemReq::PREFETCH; //always clear PREFETCH, this flag cannot propagate up
 
                 //if needed, fetch line or upgrade miss from upper level
@@ -403,6 +524,11 @@ class DCWSOLICC : public CC {
         }
 
         uint64_t processInv(const InvReq& req, int32_t lineId, uint64_t startCycle) {
+            if (req.mayMiss && (lineId == -1 || bcc->getState(lineId) == I)) {
+                //Our parent's sharer set is coarse and we don't have the line, so neither do our children
+                bcc->unlock();
+                return startCycle;
+            }
             uint64_t respCycle = tcc->processInval(req.lineAddr, lineId, req.type, req.writeback, startCycle, req.srcId); //send invalidates or downgrades to children
             bcc->processInval(req.lineAddr, lineId, req.type, req.writeback); //adjust our own state
 
@@ -410,6 +536,34 @@ class DCWSOLICC : public CC {
             return respCycle;
         }
 
+        //Barrier methods
+        void startBarrier() {
+            tcc->lock(); //barriers may invalidate children, so lock both like an access
+            bcc->lock();
+        }
+
+        void getBarrierLines(g_vector<uint32_t>& lineIds) {
+            bcc->getBarrierLines(lineIds);
+        }
+
+        uint64_t processBarrier(Address lineAddr, int32_t lineId, uint64_t startCycle, uint32_t srcId) {
+            uint64_t respCycle = startCycle;
+            DCWSOLIState state = bcc->getState(lineId);
+            if (state == O || state == L) {
+                //Children have already gone through their barrier, so any sharer left re-read the line this phase. Keep it alive for them.
+                if (state == O && tcc->numSharers(lineId)) return respCycle;
+                //Otherwise the line self-invalidates, and inclusion requires that it leaves our children first
+                bool lowerLevelWriteback = false;
+                respCycle = tcc->processEviction(lineAddr, lineId, &lowerLevelWriteback, respCycle, srcId);
+            }
+            return bcc->processBarrier(lineAddr, lineId, respCycle, srcId);
+        }
+
+        void endBarrier() {
+            bcc->unlock();
+            tcc->unlock();
+        }
+
         //Repl policy interface
         uint32_t numSharers(uint32_t lineId) {return tcc->numSharers(lineId);}
         bool isValid(uint32_t lineId) {return bcc->isValid(lineId);}
@@ -425,10 +579,12 @@ class DCWSOLITerminalCC : public CC {
 
     public:
         //Initialization
-        DCWSOLITerminalCC(uint32_t _numLines, const g_string& _name) : bcc(nullptr), numLines(_numLines), name(_name) {}
+        DCWSOLITerminalCC(uint32_t _numLines, const g_string& _name) : bcc(nullptr), numLines(_numLines), name(_name) {
+            lineStates = gm_calloc<DCWSOLIState>(numLines);
+        }
 
         void setParents(uint32_t childId, const g_vector<MemObject*>& parents, Network* network) {
-            bcc = new DCWSOLIBottomCC(numLines, childId, false /*inclusive*/);
+            bcc = new DCWSOLIBottomCC(lineStates, numLines, childId, false /*inclusive*/);
             bcc->init(parents, network, name.c_str());
         }
 
@@ -494,11 +650,32 @@ class DCWSOLITerminalCC : public CC {
         }
 
         uint64_t processInv(const InvReq& req, int32_t lineId, uint64_t startCycle) {
+            if (req.mayMiss && (lineId == -1 || bcc->getState(lineId) == I)) {
+                bcc->unlock(); //not a sharer, our parent's sharer set is coarse
+                return startCycle;
+            }
             bcc->processInval(req.lineAddr, lineId, req.type, req.writeback); //adjust our own state
             bcc->unlock();
             return startCycle; //no extra delay in terminal caches
         }
 
+        //Barrier methods
+        void startBarrier() {
+            bcc->lock();
+        }
+
+        void getBarrierLines(g_vector<uint32_t>& lineIds) {
+            bcc->getBarrierLines(lineIds);
+        }
+
+        uint64_t processBarrier(Address lineAddr, int32_t lineId, uint64_t startCycle, uint32_t srcId) {
+            return bcc->processBarrier(lineAddr, lineId, startCycle, srcId);
+        }
+
+        void endBarrier() {
+            bcc->unlock();
+        }
+
         //Repl policy interface
         uint32_t numSharers(uint32_t lineId) {return 0;} //no sharers
         bool isValid(uint32_t lineId) {return bcc->isValid(lineId);}
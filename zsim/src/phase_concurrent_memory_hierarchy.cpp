@@ -26,7 +26,7 @@
 #include "phase_concurrent_memory_hierarchy.h"
 
 static const char* accessTypeNames[] = {"GETS", "GETX", "PUTS", "PUTX"};
-static const char* invTypeNames[] = {"INV", "INVX"};
+static const char* invTypeNames[] = {"INV", "INVX", "FWD", "BAR"};
 //static const char* mesiStateNames[] = {"I", "S", "E", "M"};
 static const char* dcwsoliStateNames[] = {"I", "L", "O", "S", "W", "C", "D"};
 
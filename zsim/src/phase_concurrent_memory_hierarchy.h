@@ -58,8 +58,8 @@ typedef enum {
     BAR,  // barrier between phases
 } InvType;
 
-/* Coherence states for the MESI protocol */
-typedef enum {
+/* Coherence states for the DCWSOLI protocol. One byte, so that a set's states fit in a cache line */
+typedef enum : uint8_t {
     I, // invalid
     L, // attempted to write and lost
     O, // Old shared value
@@ -76,6 +76,10 @@ const char* InvTypeName(InvType t);
 const char* DCWSOLIStateName(DCWSOLIState s);
 
 inline bool IsGet(AccessType t) { return t == GETS || t == GETX; }
+//Replacement view of line states: L and I hold no useful data, D and W must be written back
+//TODO determine if L should be considered invalid, and L or C dirty, for zsim purposes
+inline bool IsValidState(DCWSOLIState s) { return (s != L) && (s != I); }
+inline bool IsDirtyState(DCWSOLIState s) { return (s == D) || (s == W); }
 inline bool IsPut(AccessType t) { return t == PUTS || t == PUTX; }
 
 
@@ -101,7 +105,8 @@ struct MemReq {
         NOEXCL        = (1<<2), //Do not give back E on a GETS request (turns MESI protocol into MSI for this line). Used on e.g., ifetches and NUCA.
         NONINCLWB     = (1<<3), //This is a non-inclusive writeback. Do not assume that the line was in the lower level. Used on NUCA (BankDir).
         PUTX_KEEPEXCL = (1<<4), //Non-relinquishing PUTX. On a PUTX, maintain the requestor's E state instead of removing the sharer (i.e., this is a pure writeback)
-        PREFETCH      = (1<<5), //Prefetch GETS access. Only set at level where prefetch is issued; handled early in MESICC
+        PREFETCH      = (1<<5), //Prefetch GETS or GETX access. Only set at level where prefetch is issued; handled early in MESICC
+        PUTX_SHARE    = (1<<6), //Non-relinquishing PUTX from a winner at a phase barrier (W->O). Writes back the data and drops exclusivity, but the requestor stays a sharer
     };
     uint32_t flags;
 
@@ -117,6 +122,8 @@ struct InvReq {
     bool* writeback;
     uint64_t cycle;
     uint32_t srcId;
+    // Set by directories that track sharers imprecisely (coarse vectors); the receiver may not hold the line
+    bool mayMiss;
 };
 
 /** INTERFACES **/
@@ -131,6 +138,9 @@ class MemObject : public GlobAlloc {
         virtual uint64_t access(MemReq& req) = 0;
         virtual void initStats(AggregateStat* parentStat) {}
         virtual const char* getName() = 0;
+        //Queue occupancy (0-100) of whatever serves lineAddr, for objects that model it. A hint for throttling
+        //prefetchers; weave-phase models update it concurrently, so bound-phase readers get a racy, slightly stale value.
+        virtual uint32_t getLoad(Address lineAddr) {return 0;}
 };
 
 /* Base class for all cache objects */
@@ -29,6 +29,15 @@
 //#define DBG(args...) info(args)
 #define DBG(args...)
 
+const StreamPrefetcher::Level StreamPrefetcher::levels[NUM_LEVELS] = {{1, 4}, {1, 8}, {2, 16}, {3, 32}, {4, 48}};
+
+StreamPrefetcher::StreamPrefetcher(const g_string& _name, uint32_t _startLevel, bool _storeTraining, uint32_t _throttleLoad)
+    : timestamp(0), globalLevel(_startLevel), epochUseful(0), epochUseless(0), epochLate(0),
+      storeTraining(_storeTraining), throttleLoad(_throttleLoad), mem(nullptr), name(_name)
+{
+    if (globalLevel >= NUM_LEVELS) panic("[%s] Invalid start level %d, must be 0-%d", name.c_str(), globalLevel, NUM_LEVELS - 1);
+}
+
 void StreamPrefetcher::setParents(uint32_t _childId, const g_vector<MemObject*>& parents, Network* network) {
     childId = _childId;
     if (parents.size() != 1) panic("Must have one parent");
@@ -47,20 +56,47 @@ void StreamPrefetcher::initStats(AggregateStat* parentStat) {
     s->init(name.c_str(), "Prefetcher stats");
     profAccesses.init("acc", "Accesses"); s->append(&profAccesses);
     profPrefetches.init("pf", "Issued prefetches"); s->append(&profPrefetches);
-    profDoublePrefetches.init("dpf", "Issued double prefetches"); s->append(&profDoublePrefetches);
+    profDoublePrefetches.init("dpf", "Prefetches beyond the first issued on a single access"); s->append(&profDoublePrefetches);
+    profStorePrefetches.init("spf", "Issued prefetches for store-dominated streams"); s->append(&profStorePrefetches);
+    profUseless.init("pfUseless", "Prefetched lines evicted from the stream table unused"); s->append(&profUseless);
     profPageHits.init("pghit", "Page/entry hit"); s->append(&profPageHits);
     profHits.init("hit", "Prefetch buffer hits, short and full"); s->append(&profHits);
     profShortHits.init("shortHit", "Prefetch buffer short hits"); s->append(&profShortHits);
     profStrideSwitches.init("strideSwitches", "Predicted stride switches"); s->append(&profStrideSwitches);
     profLowConfAccs.init("lcAccs", "Low-confidence accesses with no prefetches"); s->append(&profLowConfAccs);
+    profThrottled.init("thr", "Prefetching accesses throttled by memory load"); s->append(&profThrottled);
+    profLevelUps.init("lvlUp", "Global aggressiveness level increases"); s->append(&profLevelUps);
+    profLevelDowns.init("lvlDown", "Global aggressiveness level decreases"); s->append(&profLevelDowns);
     parentStat->append(s);
 }
 
+// Global feedback: every epoch, move the level new streams start at based on accuracy and lateness
+void StreamPrefetcher::resolve(uint32_t useful, uint32_t useless, uint32_t late) {
+    epochUseful += useful;
+    epochUseless += useless;
+    epochLate += late;
+    uint32_t resolved = epochUseful + epochUseless;
+    if (resolved < EPOCH_PREFETCHES) return;
+
+    if (4*epochUseful >= 3*resolved) {  // accurate (>= 75%), go further if prefetches arrive late
+        if (10*epochLate > epochUseful && globalLevel < NUM_LEVELS - 1) {
+            globalLevel++;
+            profLevelUps.inc();
+        }
+    } else if (5*epochUseful < 2*resolved && globalLevel > 0) {  // inaccurate (< 40%)
+        globalLevel--;
+        profLevelDowns.inc();
+    }
+    DBG("%s: epoch useful %d useless %d late %d, level %d", name.c_str(), epochUseful, epochUseless, epochLate, globalLevel);
+    epochUseful = epochUseless = epochLate = 0;
+}
+
 uint64_t StreamPrefetcher::access(MemReq& req) {
     uint32_t origChildId = req.childId;
     req.childId = childId;
 
-    if (req.type != GETS) return parent->access(req); //other reqs ignored, including stores
+    bool isStore = (req.type == GETX);
+    if (req.type != GETS && !(isStore && storeTraining)) return parent->access(req); //other reqs ignored, including stores unless they train streams
 
     profAccesses.inc();
 
@@ -97,9 +133,15 @@ uint64_t StreamPrefetcher::access(MemReq& req) {
 
         if (cand < 16) {
             idx = cand;
-            array[idx].alloc(reqCycle);
+            uint32_t unused = array[idx].valid.count();  // prefetched but never demanded
+            if (unused) {
+                profUseless.inc(unused);
+                resolve(0, unused, 0);
+            }
+            array[idx].alloc(reqCycle, globalLevel);
             array[idx].lastPos = pos;
             array[idx].ts = timestamp++;
+            if (isStore) array[idx].storeConf.inc();
             tag[idx] = pageAddr;
         }
         DBG("%s: MISS alloc idx %d", name.c_str(), idx);
@@ -109,6 +151,9 @@ uint64_t StreamPrefetcher::access(MemReq& req) {
         array[idx].ts = timestamp++;
         DBG("%s: PAGE HIT idx %d", name.c_str(), idx);
 
+        if (isStore) e.storeConf.inc();
+        else e.storeConf.dec();
+
         // 1. Did we prefetch-hit?
         bool shortPrefetch = false;
         if (e.valid[pos]) {
@@ -118,50 +163,64 @@ uint64_t StreamPrefetcher::access(MemReq& req) {
             respCycle = MAX(pfRespCycle, respCycle);
             e.lastCycle = MAX(respCycle, e.lastCycle);
             profHits.inc();
-            if (shortPrefetch) profShortHits.inc();
+            if (shortPrefetch) {
+                profShortHits.inc();
+                if (e.level < NUM_LEVELS - 1) e.level++;  // late, run further ahead
+            }
+            resolve(1, 0, shortPrefetch);
             DBG("%s: pos %d prefetched on %ld, pf resp %ld, demand resp %ld, short %d", name.c_str(), pos, e.times[pos].startCycle, pfRespCycle, respCycle, shortPrefetch);
         }
 
         // 2. Update predictors, issue prefetches
         int32_t stride = pos - e.lastPos;
-        DBG("%s: pos %d lastPos %d lastLastPost %d e.stride %d", name.c_str(), pos, e.lastPos, e.lastLastPos, e.stride);
-        if (e.stride == stride) {
+        DBG("%s: pos %d lastPos %d lastLastPost %d e.stride %d level %d", name.c_str(), pos, e.lastPos, e.lastLastPos, e.stride, e.level);
+        if (stride == 0) {
+            // Same line again, typically a store upgrading the line we just read. Says nothing about the stream.
+        } else if (e.stride == stride) {
             e.conf.inc();
             if (e.conf.pred()) {  // do prefetches
-                int32_t fetchDepth = (e.lastPrefetchPos - e.lastPos)/stride;
+                int32_t fetchDepth = ((int32_t)(e.lastPrefetchPos - pos))/stride;
                 uint32_t prefetchPos = e.lastPrefetchPos + stride;
                 if (fetchDepth < 1) {
                     prefetchPos = pos + stride;
-                    fetchDepth = 1;
+                    fetchDepth = 0;
                 }
-                DBG("%s: pos %d stride %d conf %d lastPrefetchPos %d prefetchPos %d fetchDepth %d", name.c_str(), pos, stride, e.conf.counter(), e.lastPrefetchPos, prefetchPos, fetchDepth);
-
-                if (prefetchPos < 64 && !e.valid[prefetchPos]) {
-//                    MESIState state = I;
-                    DCWSOLIState state = I;
-                    MemReq pfReq = {req.lineAddr + prefetchPos - pos, GETS, req.childId, &state, reqCycle, req.childLock, state, req.srcId, MemReq::PREFETCH};
-                    uint64_t pfRespCycle = parent->access(pfReq);  // FIXME, might segfault
-                    e.valid[prefetchPos] = true;
-                    e.times[prefetchPos].fill(reqCycle, pfRespCycle);
-                    profPrefetches.inc();
-
-                    if (shortPrefetch && fetchDepth < 8 && prefetchPos + stride < 64 && !e.valid[prefetchPos + stride]) {
-                        prefetchPos += stride;
-                        pfReq.lineAddr += stride;
-                        pfRespCycle = parent->access(pfReq);
+
+                uint32_t degree = levels[e.level].degree;
+                int32_t distance = levels[e.level].distance;
+                if (mem && mem->getLoad(req.lineAddr) >= throttleLoad) {
+                    // Memory queues are filling up: keep the current lead, but don't grow it
+                    degree = 1;
+                    distance = MIN(distance, fetchDepth + 1);
+                    profThrottled.inc();
+                }
+                bool storeStream = storeTraining && e.storeConf.pred();
+                DBG("%s: pos %d stride %d conf %d lastPrefetchPos %d prefetchPos %d fetchDepth %d degree %d distance %d", name.c_str(), pos, stride, e.conf.counter(), e.lastPrefetchPos, prefetchPos, fetchDepth, degree, distance);
+
+                uint32_t issued = 0;
+                while (issued < degree && fetchDepth < distance && prefetchPos < 64) {
+                    if (!e.valid[prefetchPos]) {
+                        DCWSOLIState state = I;
+                        MemReq pfReq = {req.lineAddr + prefetchPos - pos, GETS, req.childId, &state, reqCycle, req.childLock, state, req.srcId, MemReq::PREFETCH};
+                        uint64_t pfRespCycle = parent->access(pfReq);  // FIXME, might segfault
+                        assert(state == I);  // prefetch access should not give us any permissions
                         e.valid[prefetchPos] = true;
                         e.times[prefetchPos].fill(reqCycle, pfRespCycle);
                         profPrefetches.inc();
-                        profDoublePrefetches.inc();
+                        if (issued) profDoublePrefetches.inc();
+                        if (storeStream) profStorePrefetches.inc();
+                        issued++;
                     }
                     e.lastPrefetchPos = prefetchPos;
-                    assert(state == I);  // prefetch access should not give us any permissions
+                    prefetchPos += stride;
+                    fetchDepth++;
                 }
             } else {
                 profLowConfAccs.inc();
             }
         } else {
             e.conf.dec();
+            if (e.level) e.level--;  // mispredicted, back off
             // See if we need to switch strides
             if (!e.conf.pred()) {
                 int32_t lastStride = e.lastPos - e.lastLastPos;
@@ -175,8 +234,10 @@ uint64_t StreamPrefetcher::access(MemReq& req) {
             e.lastPrefetchPos = pos;
         }
 
-        e.lastLastPos = e.lastPos;
-        e.lastPos = pos;
+        if (stride) {
+            e.lastLastPos = e.lastPos;
+            e.lastPos = pos;
+        }
     }
 
     req.childId = origChildId;
@@ -55,6 +55,17 @@ class SatCounter {
  * but (a) no up/down distinction, and (b) strided operation based on dominant stride detection
  * to try to subsume as much of the L1 IP/strided prefetcher as possible.
  *
+ * Aggressiveness is feedback-directed. Each stream runs at a level, which sets how many prefetches
+ * it issues per access (degree) and how far ahead of the demand stream it may run (distance).
+ * Streams start at a global level, which moves with the accuracy and lateness measured over epochs
+ * of resolved prefetches; each stream then goes up on late (short) hits and down on mispredictions.
+ * When the memory controller's queues fill past throttleLoad, streams issue one prefetch at most
+ * and stop running further ahead. With storeTraining, stores train streams too, so store
+ * streams get prefetched. These are still GETS: the directory grants them exclusive-clean (C) when
+ * nobody else shares the line, so the later store upgrades silently. Under DCWSOLI, a GETX
+ * prefetch would claim the phase's write race, and make real writers lose even if the core never
+ * stores, so prefetches never ask for write permission.
+ *
  * FIXME: For now, mostly hardcoded; 64-line entries (4KB w/64-byte lines), fixed granularities, etc.
  * TODO: Adapt to use weave models
  */
@@ -75,14 +86,19 @@ class StreamPrefetcher : public BaseCache {
             AccessTimes times[64];
             std::bitset<64> valid;
 
+            uint32_t level;
+            SatCounter<3, 2, 0> storeConf;  // predicts a store stream
+
             uint32_t lastPos;
             uint32_t lastLastPos;
             uint32_t lastPrefetchPos;
             uint64_t lastCycle;  // updated on alloc and hit
             uint64_t ts;
 
-            void alloc(uint64_t curCycle) {
+            void alloc(uint64_t curCycle, uint32_t _level) {
                 stride = 1;
+                level = _level;
+                storeConf.reset();
                 lastPos = 0;
                 lastLastPos = 0;
                 lastPrefetchPos = 0;
@@ -96,19 +112,38 @@ class StreamPrefetcher : public BaseCache {
         Address tag[16];
         Entry array[16];
 
+        struct Level {
+            uint32_t degree;
+            uint32_t distance;  // in strides
+        };
+        static const Level levels[];
+        static const uint32_t NUM_LEVELS = 5;
+        static const uint32_t EPOCH_PREFETCHES = 256;  // resolved prefetches per global feedback epoch
+
+        uint32_t globalLevel;
+        uint32_t epochUseful, epochUseless, epochLate;
+
+        const bool storeTraining;
+        const uint32_t throttleLoad;  // memory load (0-100) that throttles prefetching
+
         Counter profAccesses, profPrefetches, profDoublePrefetches, profPageHits, profHits, profShortHits, profStrideSwitches, profLowConfAccs;
+        Counter profUseless, profStorePrefetches, profThrottled, profLevelUps, profLevelDowns;
 
         MemObject* parent;
+        MemObject* mem;  // memory controller we watch for throttling, may be nullptr
         BaseCache* child;
         uint32_t childId;
         g_string name;
 
+        void resolve(uint32_t useful, uint32_t useless, uint32_t late);
+
     public:
-        explicit StreamPrefetcher(const g_string& _name) : timestamp(0), name(_name) {}
+        StreamPrefetcher(const g_string& _name, uint32_t _startLevel, bool _storeTraining, uint32_t _throttleLoad);
         void initStats(AggregateStat* parentStat);
         const char* getName() { return name.c_str();}
         void setParents(uint32_t _childId, const g_vector<MemObject*>& parents, Network* network);
         void setChildren(const g_vector<BaseCache*>& children, Network* network);
+        void setMemory(MemObject* _mem) {mem = _mem;}
 
         uint64_t access(MemReq& req);
         uint64_t invalidate(const InvReq& req);
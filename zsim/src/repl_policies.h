@@ -43,11 +43,15 @@
 class ReplPolicy : public GlobAlloc {
     protected:
         CC* cc; //coherence controller, used to figure out whether candidates are valid or number of sharers
+        const DCWSOLIState* lineStates; //cc's line states, so ranking candidates does not need virtual calls
+
+        inline bool isValidLine(uint32_t id) const {return IsValidState(lineStates[id]);}
+        inline bool isDirtyLine(uint32_t id) const {return IsDirtyState(lineStates[id]);}
 
     public:
-        ReplPolicy() : cc(nullptr) {}
+        ReplPolicy() : cc(nullptr), lineStates(nullptr) {}
 
-        virtual void setCC(CC* _cc) {cc = _cc;}
+        virtual void setCC(CC* _cc) {cc = _cc; lineStates = cc->getLineStates();}
 
         virtual void update(uint32_t id, const MemReq* req) = 0;
         virtual void replaced(uint32_t id) = 0;
@@ -140,7 +144,7 @@ class LRUReplPolicy : public ReplPolicy {
             // (1) valid (if not valid, it's 0)
             // (2) sharers, and
             // (3) timestamp
-            return (sharersAware? cc->numSharers(id) : 0)*timestamp + array[id]*cc->isValid(id);
+            return (sharersAware? cc->numSharers(id) : 0)*timestamp + array[id]*isValidLine(id);
         }
 };
 
@@ -355,7 +359,7 @@ class LFUReplPolicy : public LegacyReplPolicy {
         }
 
         void recordCandidate(uint32_t id) {
-            Rank candRank = {array[id], cc? cc->numSharers(id) : 0, cc->isValid(id)};
+            Rank candRank = {array[id], cc? cc->numSharers(id) : 0, isValidLine(id)};
 
             if (bestCandidate == -1 || candRank.lessThan(bestRank, timestamp)) {
                 bestRank = candRank;
@@ -39,12 +39,13 @@ class SRRIPReplPolicy : public virtual ReplPolicy {
         VectorCounter profDistrib, profEvictionDistrib;
         Counter profInsertions, profPromotions, profDemotions;
 
-        uint32_t* array;
+        uint8_t* array; //prios are at most vmax, and one byte each keeps a 64-way set in a single cache line
         const uint32_t numLines;
         const uint32_t vmax;
         MTRand rnd;
 
-        virtual uint32_t prioToRank(uint32_t id, uint32_t prio) {
+        //Not virtual: it's called on every candidate, and no policy overrides it
+        inline uint32_t prioToRank(uint32_t id, uint32_t prio) {
             return prio;
         }
         
@@ -53,9 +54,10 @@ class SRRIPReplPolicy : public virtual ReplPolicy {
             hits = 0;
             accsUntilUpdate = UPDATE_INTERVAL;
             
-            array = gm_calloc<uint32_t>(numLines);
+            // Checked even without asserts: a larger M would silently wrap prios around
+            if (M < 1 || M >= 8) panic("RRIP prios are stored in 8 bits, M must be 1-7, %d given", M);
+            array = gm_calloc<uint8_t>(numLines);
             // In normal SRRIP, values go from 0-2^M-1. We do 0-2^M, reserve 0 for unused blocks, and invert the priority scheme (higher value is higher priority)
-            assert(vmax > 1); //otherwise this is useless...
         }
 
         void initStats(AggregateStat* parent) {
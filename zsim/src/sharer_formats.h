@@ -0,0 +1,212 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHARER_FORMATS_H_
+#define SHARER_FORMATS_H_
+
+#include <stdint.h>
+#include <string.h>
+#include "bithacks.h"
+#include "log.h"
+
+/* Sharer-set encodings for the phase-concurrent directory (DCWSOLITopCC).
+ *
+ * Each directory entry owns wordsPerEntry() 64-bit words of sharer storage, plus a
+ * coarse bit and the exact sharer count, which live in the entry itself. Formats:
+ *  - FullMap: one bit per child. Exact, costs numChildren bits.
+ *  - LimitedPtr: up to maxPtrs child pointers (8 bits, or 16 with more than 256 children)
+ *    in a single word. On overflow, the word becomes a coarse vector where each bit covers
+ *    groupSize consecutive children.
+ *  - Clustered: for very large levels. Children are split in up to maxClusters clusters of
+ *    groupSize consecutive children. A single sharer is tracked exactly (so exclusive lines
+ *    never need a multicast), and from the second one on, the entry becomes a coarse vector
+ *    with one bit per cluster. This is LimitedPtr with one pointer and a multi-word vector.
+ * Coarse entries only answer "maybe", so invalidates are multicast to whole groups, and bits
+ * are only dropped when the entry empties.
+ *
+ * To avoid virtual calls on the access path, this is a plain class that switches on the format.
+ */
+class SharerFormat {
+    public:
+        typedef enum {
+            FULL_MAP,
+            LIMITED_PTR,
+            CLUSTERED
+        } Type;
+
+    private:
+        Type type;
+        uint32_t maxPtrs;
+        uint32_t maxClusters; //Clustered only
+        uint32_t numChildren;
+        uint32_t words;
+        uint32_t ptrBits; //8 or 16
+        uint32_t groupSize; //children per coarse vector bit
+
+        inline uint32_t getPtr(const uint64_t* s, uint32_t i) const {
+            return (ptrBits == 8)? ((const uint8_t*) s)[i] : ((const uint16_t*) s)[i];
+        }
+
+        inline void setPtr(uint64_t* s, uint32_t i, uint32_t c) const {
+            if (ptrBits == 8) ((uint8_t*) s)[i] = c;
+            else ((uint16_t*) s)[i] = c;
+        }
+
+        inline void setGroup(uint64_t* s, uint32_t c) const {
+            uint32_t g = c/groupSize;
+            s[g/64] |= 1ul << (g % 64);
+        }
+
+    public:
+        SharerFormat(Type _type, uint32_t _maxPtrs, uint32_t _maxClusters = 0) : type(_type), maxPtrs(_maxPtrs), maxClusters(_maxClusters),
+            numChildren(0), words(0), ptrBits(0), groupSize(0) {}
+
+        void init(uint32_t _numChildren, const char* name) {
+            numChildren = _numChildren;
+            if (numChildren > (1u << 16) - 1) panic("[%s] Directories can't track %d children (max %d)", name, numChildren, (1u << 16) - 1);
+            if (type == FULL_MAP) {
+                words = (numChildren + 63)/64;
+                if (words == 0) words = 1;
+                return;
+            }
+
+            ptrBits = (numChildren <= 256)? 8 : 16;
+            if (type == CLUSTERED) {
+                if (maxClusters == 0 || maxClusters % 64) panic("[%s] Clustered directory needs a multiple of 64 clusters, got %d", name, maxClusters);
+                maxPtrs = 1;
+                groupSize = (numChildren + maxClusters - 1)/maxClusters;
+                words = (((numChildren + groupSize - 1)/groupSize) + 63)/64;
+            } else {
+                if (maxPtrs == 0 || maxPtrs*ptrBits > 64) panic("[%s] LimitedPtr directory with %d-bit pointers needs 1-%d pointers, got %d", name, ptrBits, 64/ptrBits, maxPtrs);
+                groupSize = (numChildren + 63)/64;
+                words = 1;
+            }
+            if (groupSize == 0) groupSize = 1;
+            if (words == 0) words = 1;
+        }
+
+        inline Type getType() const {return type;}
+        inline uint32_t wordsPerEntry() const {return words;}
+        inline uint32_t childrenPerGroup() const {return (type == FULL_MAP)? 1 : groupSize;}
+
+        //Sharer storage in hardware, excluding the count and state bits every format needs
+        uint32_t bitsPerEntry() const {
+            if (type == FULL_MAP) return numChildren;
+            uint32_t bits = 1;
+            while ((1u << bits) < numChildren) bits++;
+            return 1 /*coarse bit*/ + MAX(maxPtrs*bits, (numChildren + groupSize - 1)/groupSize);
+        }
+
+        const char* name() const {
+            return (type == FULL_MAP)? "FullMap" : (type == LIMITED_PTR)? "LimitedPtr" : "Clustered";
+        }
+
+        inline void clear(uint64_t* s, bool* coarse) const {
+            memset(s, 0, words*sizeof(uint64_t));
+            *coarse = false;
+        }
+
+        //Exact for non-coarse entries, a superset for coarse ones
+        inline bool contains(const uint64_t* s, bool coarse, uint32_t numSharers, uint32_t c) const {
+            if (type == FULL_MAP) return (s[c/64] >> (c % 64)) & 1;
+            if (coarse) {
+                uint32_t g = c/groupSize;
+                return (s[g/64] >> (g % 64)) & 1;
+            }
+            for (uint32_t i = 0; i < numSharers; i++) {
+                if (getPtr(s, i) == c) return true;
+            }
+            return false;
+        }
+
+        //numSharers is the count before adding c, which must not be a sharer. Returns true if the entry overflowed.
+        inline bool add(uint64_t* s, bool* coarse, uint32_t numSharers, uint32_t c) const {
+            if (type == FULL_MAP) {
+                s[c/64] |= 1ul << (c % 64);
+                return false;
+            }
+            if (*coarse) {
+                setGroup(s, c);
+                return false;
+            }
+            if (numSharers < maxPtrs) {
+                setPtr(s, numSharers, c);
+                return false;
+            }
+            //Out of pointers, switch to a coarse vector
+            uint32_t ptrs[8];
+            for (uint32_t i = 0; i < numSharers; i++) ptrs[i] = getPtr(s, i);
+            memset(s, 0, words*sizeof(uint64_t));
+            setGroup(s, c);
+            for (uint32_t i = 0; i < numSharers; i++) setGroup(s, ptrs[i]);
+            *coarse = true;
+            return true;
+        }
+
+        //numSharers is the count before removing c. Coarse entries keep c's group bit, since other children may share it.
+        inline void remove(uint64_t* s, bool* coarse, uint32_t numSharers, uint32_t c) const {
+            if (type == FULL_MAP) {
+                s[c/64] &= ~(1ul << (c % 64));
+            } else if (*coarse) {
+                if (numSharers == 1) clear(s, coarse);
+            } else {
+                for (uint32_t i = 0; i < numSharers; i++) {
+                    if (getPtr(s, i) == c) {
+                        setPtr(s, i, getPtr(s, numSharers - 1));
+                        return;
+                    }
+                }
+                panic("Removing child %d, which is not a sharer", c);
+            }
+        }
+
+        //Calls f(childId) on every child that may share the line. On coarse entries, this includes non-sharers.
+        template <typename F>
+        inline void forEach(const uint64_t* s, bool coarse, uint32_t numSharers, F f) const {
+            if (type == FULL_MAP) {
+                for (uint32_t w = 0; w < words; w++) {
+                    uint64_t bits = s[w];
+                    while (bits) {
+                        f(w*64 + __builtin_ctzl(bits));
+                        bits &= bits - 1;
+                    }
+                }
+            } else if (coarse) {
+                for (uint32_t w = 0; w < words; w++) {
+                    uint64_t bits = s[w];
+                    while (bits) {
+                        uint32_t first = (w*64 + __builtin_ctzl(bits))*groupSize;
+                        uint32_t last = MIN(first + groupSize, numChildren);
+                        for (uint32_t c = first; c < last; c++) f(c);
+                        bits &= bits - 1;
+                    }
+                }
+            } else {
+                for (uint32_t i = 0; i < numSharers; i++) f(getPtr(s, i));
+            }
+        }
+};
+
+#endif  // SHARER_FORMATS_H_
@@ -85,6 +85,9 @@ void SimpleCore::join() {
     //info("[%s] Joined, curCycle %ld phaseEnd %ld haltedCycles %ld", name.c_str(), curCycle, phaseEndCycle, haltedCycles);
 }
 
+void SimpleCore::phaseBarrier() {
+    curCycle = l1d->barrier(curCycle);
+}
 
 //Static class functions: Function pointers and trampolines
 
@@ -55,6 +55,7 @@ class SimpleCore : public Core {
 
         void contextSwitch(int32_t gid);
         virtual void join();
+        virtual void phaseBarrier();
 
         InstrFuncPtrs GetFuncPtrs();
 
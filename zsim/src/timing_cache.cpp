@@ -94,7 +94,11 @@ void TimingCache::initStats(AggregateStat* parentStat) {
     AggregateStat* cacheStat = new AggregateStat();
     cacheStat->init(name.c_str(), "Timing cache stats");
     initCacheStats(cacheStat);
+    initExtraStats(cacheStat);
+    parentStat->append(cacheStat);
+}
 
+void TimingCache::initExtraStats(AggregateStat* cacheStat) {
     //Stats specific to timing cache
     profOccHist.init("occHist", "Occupancy MSHR cycle histogram", numMSHRs+1);
     cacheStat->append(&profOccHist);
@@ -106,8 +110,6 @@ void TimingCache::initStats(AggregateStat* parentStat) {
     cacheStat->append(&profHitLat);
     cacheStat->append(&profMissRespLat);
     cacheStat->append(&profMissLat);
-
-    parentStat->append(cacheStat);
 }
 
 // TODO(dsm): This is copied verbatim from Cache. We should split Cache into different methods, then call those.
@@ -121,6 +123,7 @@ uint64_t TimingCache::access(MemReq& req) {
     uint64_t evDoneCycle = 0;
 
     uint64_t respCycle = req.cycle;
+    lastEvictedLineAddr = 0;
     bool skipAccess = cc->startAccess(req); //may need to skip access due to races (NOTE: may change req.type!)
     if (likely(!skipAccess)) {
         bool updateReplacement = (req.type == GETS) || (req.type == GETX);
@@ -140,6 +143,7 @@ uint64_t TimingCache::access(MemReq& req) {
             evDoneCycle = cc->processEviction(req, wbLineAddr, lineId, respCycle); //if needed, send invalidates/downgrades to lower level, and wb to upper level
 
             array->postinsert(req.lineAddr, &req, lineId); //do the actual insertion. NOTE: Now we must split insert into a 2-phase thing because cc unlocks us.
+            lastEvictedLineAddr = wbLineAddr;
 
             if (evRec->hasRecord()) writebackRecord = evRec->popRecord();
         }
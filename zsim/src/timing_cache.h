@@ -59,6 +59,7 @@ class TimingCache : public Cache {
         TimingCache(uint32_t _numLines, CC* _cc, CacheArray* _array, ReplPolicy* _rp, uint32_t _accLat, uint32_t _invLat, uint32_t mshrs,
                 uint32_t tagLat, uint32_t ways, uint32_t cands, uint32_t _domain, const g_string& _name);
         void initStats(AggregateStat* parentStat);
+        void initExtraStats(AggregateStat* cacheStat);
 
         uint64_t access(MemReq& req);
 
@@ -77,6 +77,12 @@ void TimingCore::leave() {
     cRec.notifyLeave(curCycle);
 }
 
+void TimingCore::phaseBarrier() {
+    uint64_t startCycle = curCycle;
+    curCycle = l1d->barrier(curCycle);
+    cRec.record(startCycle);
+}
+
 void TimingCore::loadAndRecord(Address addr) {
     uint64_t startCycle = curCycle;
     curCycle = l1d->load(addr, curCycle);
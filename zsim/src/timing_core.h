@@ -57,6 +57,7 @@ class TimingCore : public Core {
 
         void contextSwitch(int32_t gid);
         virtual void join();
+        virtual void phaseBarrier();
         virtual void leave();
 
         InstrFuncPtrs GetFuncPtrs();
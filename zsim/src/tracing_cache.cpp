@@ -35,7 +35,11 @@ TracingCache::TracingCache(uint32_t _numLines, CC* _cc, CacheArray* _array, Repl
 void TracingCache::setChildren(const g_vector<BaseCache*>& children, Network* network) {
     Cache::setChildren(children, network);
     //We need to initialize the trace writer here because it needs the number of children
-    atw = new AccessTraceWriter(tracefile, children.size());
+    initTraceWriter(children.size());
+}
+
+void TracingCache::initTraceWriter(uint32_t numChildren) {
+    atw = new AccessTraceWriter(tracefile, numChildren);
     zinfo->traceWriters->push_back(atw); //register it so that it gets flushed when the simulation ends
 }
 
@@ -1133,6 +1133,7 @@ VOID SimEnd() {
 #define ZSIM_MAGIC_OP_ROI_END           (1026)
 #define ZSIM_MAGIC_OP_REGISTER_THREAD   (1027)
 #define ZSIM_MAGIC_OP_HEARTBEAT         (1028)
+#define ZSIM_MAGIC_OP_PHASE_BARRIER     (1034)
 
 VOID HandleMagicOp(THREADID tid, ADDRINT op) {
     switch (op) {
@@ -1190,6 +1191,13 @@ VOID HandleMagicOp(THREADID tid, ADDRINT op) {
         case ZSIM_MAGIC_OP_HEARTBEAT:
             procTreeNode->heartbeat(); //heartbeats are per process for now
             return;
+        case ZSIM_MAGIC_OP_PHASE_BARRIER:
+            //Only meaningful if the thread is simulating on a core (not fast-forwarding or waiting to join)
+            if (fPtrs[tid].type == FPTR_ANALYSIS) {
+                cores[tid]->phaseBarrier();
+                zinfo->coreBarriers[getCid(tid)]++; //ends this core's write races (see DCWSOLITopCC)
+            }
+            return;
 
         // HACK: Ubik magic ops
         case 1029:
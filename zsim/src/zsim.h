@@ -90,6 +90,9 @@ struct GlobSimInfo {
     ContentionSim* contentionSim;
     EventRecorder** eventRecorders; //CID->EventRecorder* array
 
+    //CID -> phase barriers the core has gone through. DCWSOLI directories use this to end write races.
+    volatile uint64_t* coreBarriers;
+
     PAD();
 
     //World-readable